@@ -0,0 +1,277 @@
+// Headless batch rendering: a job list is rendered with ImageRenderer3D on all cores, no window involved.
+//
+// usage: RenderFarm <jobs file> [threads] [overdraw] [bands=<rows>]
+//
+// One job per line, empty lines and lines starting with # are skipped:
+//   model texture width height eyeX eyeY eyeZ centerX centerY centerZ frames output
+// texture can be - for an untextured model, frames > 1 renders the same image again to measure throughput.
+// Paths are relative to the jobs file, ".tga" is appended to the output like ImageRenderer3D::ExportImage does.
+// With overdraw, the overdraw heatmap of the last frame of each job is written next to it as <output>_overdraw.tga.
+// With bands, every image is rendered that many rows at a time and the bands of its last frame are streamed
+// to the file as they are done, so the size of the images is only limited by the tga format, not by memory.
+
+#include "ImageRenderer3D.h"
+#include "model.h"
+#include "Camera.h"
+#include "Trace.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MathLib;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    double secondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    struct Job
+    {
+        std::string model;
+        std::string texture;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        Camera camera;
+        int frames = 1;
+        std::string output;
+    };
+
+    struct JobResult
+    {
+        double seconds = 0.;
+        RasterStats stats;                  // over all frames
+        bool written = false;
+        std::future<bool> exported;         // the image handed to the export queue, not set in band mode
+    };
+
+    std::string directoryOf(const std::string& path)
+    {
+        const auto slash = path.find_last_of("/\\");
+        return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    }
+
+    std::string resolve(const std::string& directory, const std::string& path)
+    {
+        const auto absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || path.find(':') != std::string::npos);
+        return absolute ? path : directory + path;
+    }
+
+    bool readJobs(const std::string& path, std::vector<Job>& jobs)
+    {
+        std::ifstream in(path);
+        if (!in.is_open())
+        {
+            spdlog::error("can't open the jobs file {}", path);
+            return false;
+        }
+
+        const auto directory = directoryOf(path);
+        std::string line;
+        for (auto lineNumber = 1; std::getline(in, line); lineNumber++)
+        {
+            const auto first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#')
+                continue;
+
+            auto job = Job();
+            auto eye = std::array<double, 3>();
+            auto center = std::array<double, 3>();
+            std::istringstream iss(line);
+            if (!(iss >> job.model >> job.texture >> job.width >> job.height >> eye[0] >> eye[1] >> eye[2]
+                >> center[0] >> center[1] >> center[2] >> job.frames >> job.output) || job.width == 0 || job.height == 0)
+            {
+                spdlog::error("{}:{}: expected model texture width height eyeX eyeY eyeZ centerX centerY centerZ frames output", path, lineNumber);
+                return false;
+            }
+            job.model = resolve(directory, job.model);
+            job.texture = job.texture == "-" ? std::string() : resolve(directory, job.texture);
+            job.output = resolve(directory, job.output);
+            job.camera.eye = Vec3f{ eye[0], eye[1], eye[2] };
+            job.camera.center = Vec3f{ center[0], center[1], center[2] };
+            job.frames = std::max(job.frames, 1);
+            jobs.push_back(job);
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        spdlog::error("usage: {} <jobs file> [threads] [overdraw] [bands=<rows>]", argv[0]);
+        return 1;
+    }
+
+    auto jobs = std::vector<Job>();
+    if (!readJobs(argv[1], jobs))
+        return 1;
+
+    auto threadCount = argc > 2 ? std::atoi(argv[2]) : static_cast<int>(std::thread::hardware_concurrency());
+    threadCount = std::max(1, std::min(threadCount, static_cast<int>(jobs.size())));
+    auto overdraw = false;
+    auto bandRows = 0u;
+    for (auto i = 3; i < argc; i++)
+    {
+        const auto option = std::string(argv[i]);
+        if (option == "overdraw")
+            overdraw = true;
+        else if (option.compare(0, 6, "bands=") == 0)
+            bandRows = static_cast<uint32_t>(std::max(0, std::atoi(option.c_str() + 6)));
+        else
+        {
+            spdlog::error("unknown option {}", option);
+            return 1;
+        }
+    }
+    if (overdraw && bandRows > 0)
+    {
+        spdlog::warn("the overdraw heatmaps need whole images, they are not written when rendering in bands");
+        overdraw = false;
+    }
+
+    // every model and texture pair is loaded once, the renderers only ever read them. Each job's model is looked up
+    // here, before the threads start, so the workers never touch the map.
+    auto loadStart = Clock::now();
+    auto models = std::map<std::pair<std::string, std::string>, std::unique_ptr<Model>>();
+    auto jobModels = std::vector<const Model*>();
+    for (const auto& job : jobs)
+    {
+        auto& model = models[{ job.model, job.texture }];
+        if (!model)
+        {
+            model = std::make_unique<Model>(job.model.c_str());
+            if (!job.texture.empty())
+                model->loadTexture(job.texture.c_str());
+        }
+        jobModels.push_back(model.get());
+    }
+    spdlog::info("{} jobs, {} models loaded in {:.1f} ms, rendering on {} threads", jobs.size(), models.size(),
+        secondsSince(loadStart) * 1000., threadCount);
+
+    // the threads pull the next job from a shared counter, each with its own renderer reused from job to job.
+    // A renderer changing size hands its image buffer to the pool, the next job of that size on any thread takes it.
+    auto bufferPool = TGABufferPool();
+    TGAImage::set_buffer_pool(&bufferPool);
+    // the finished images are encoded and written there while the workers go on with their next jobs
+    auto exportQueue = ExportQueue(1, threadCount + 1);
+    auto results = std::vector<JobResult>(jobs.size());
+    auto nextJob = std::atomic<size_t>(0);
+    const auto renderStart = Clock::now();
+    auto workers = std::vector<std::thread>();
+    for (auto t = 0; t < threadCount; t++)
+    {
+        workers.emplace_back([&]()
+            {
+                auto renderer = ImageRenderer3D(1, 1);
+                renderer.SetRasterMode(RasterMode::FixedPoint);
+                renderer.EnableOverdrawHeatmap(overdraw);
+                for (auto index = nextJob++; index < jobs.size(); index = nextJob++)
+                {
+                    const auto& job = jobs[index];
+                    const auto& model = *jobModels[index];
+                    auto& result = results[index];
+
+                    TR_TRACE_SCOPE("job");
+                    if (bandRows > 0)
+                    {
+                        // bottom up like the renderer's images, the file gets a bottom-left origin instead of a flip,
+                        // and encoded on this thread only since the other workers already take the other cores
+                        auto writer = TGAWriter();
+                        result.written = writer.open((job.output + ".tga").c_str(), job.width, job.height, TGAImage::RGB, true, true, 1);
+                        const auto start = Clock::now();
+                        for (auto frame = 0; frame < job.frames; frame++)
+                        {
+                            TR_TRACE_SCOPE("frame");
+                            for (auto y = 0u; y < job.height; y += bandRows)
+                            {
+                                renderer.ClearBand(job.width, job.height, y, bandRows);
+                                renderer.DrawModel(model, job.camera);
+                                // Every band goes through all the triangles of the frame, they are only counted as
+                                // submitted, culled and clipped with the first one. What the bands rasterize adds up,
+                                // a triangle across several bands is rasterized in each.
+                                auto bandStats = renderer.GetRasterStats();
+                                if (y > 0)
+                                    bandStats.submitted = bandStats.culled = bandStats.clipped = 0;
+                                result.stats += bandStats;
+                                if (frame + 1 == job.frames)
+                                    result.written = result.written && renderer.ExportBand(writer);
+                            }
+                        }
+                        result.seconds = secondsSince(start);
+                        result.written = writer.close() && result.written;
+                        continue;
+                    }
+
+                    const auto start = Clock::now();
+                    for (auto frame = 0; frame < job.frames; frame++)
+                    {
+                        TR_TRACE_SCOPE("frame");
+                        renderer.Clear(job.width, job.height);
+                        renderer.DrawModel(model, job.camera);
+                        // the renderer counts for its own thread, the job merges frame after frame
+                        result.stats += renderer.GetRasterStats();
+                    }
+                    result.seconds = secondsSince(start);
+                    result.exported = renderer.ExportImage(exportQueue, job.output);
+                    result.written = !overdraw || renderer.ExportOverdrawHeatmap(job.output + "_overdraw");
+                }
+            });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        auto& result = results[i];
+        if (!result.exported.valid())
+            continue;
+        try
+        {
+            result.written = result.exported.get() && result.written;
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::error("{}.tga: {}", jobs[i].output, e.what());
+            result.written = false;
+        }
+    }
+    TGAImage::set_buffer_pool(nullptr);
+    const auto wallSeconds = secondsSince(renderStart);
+
+    auto totalFrames = 0ull;
+    auto totals = RasterStats();
+    auto failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const auto& job = jobs[i];
+        const auto& result = results[i];
+        spdlog::info("{}.tga: {}x{}, {} frames in {:.1f} ms, {:.1f} frames/s, {:.0f} triangles/s ({} rasterized per frame, {:.1f}% of the box traversal wasted){}",
+            job.output, job.width, job.height, job.frames, result.seconds * 1000., job.frames / result.seconds,
+            result.stats.submitted / result.seconds, result.stats.rasterized / job.frames, 100. * result.stats.BoxWaste(),
+            result.written ? "" : ", NOT WRITTEN");
+        totalFrames += job.frames;
+        totals += result.stats;
+        failed += result.written ? 0 : 1;
+    }
+    spdlog::info("all jobs: {} frames in {:.1f} ms on {} threads, {:.1f} frames/s, {:.0f} triangles/s",
+        totalFrames, wallSeconds * 1000., threadCount, totalFrames / wallSeconds, totals.submitted / wallSeconds);
+    totals.Log("all jobs");
+
+    return failed == 0 ? 0 : 1;
+}
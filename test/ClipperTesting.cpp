@@ -0,0 +1,98 @@
+#include <doctest/doctest.h>
+
+#include <Clipper.h>
+
+namespace
+{
+    ClipVertex vertex(double x, double y, double z, double w, double varying = 0.)
+    {
+        auto v = ClipVertex();
+        v.position = Vec4f{ x, y, z, w };
+        v.varyings[0] = varying;
+        return v;
+    }
+}
+
+TEST_SUITE("Clipper tests")
+{
+    TEST_CASE("A triangle inside the guard band is left as it is")
+    {
+        const auto clipper = Clipper();
+        auto polygon = Clipper::Polygon();
+        // partly outside of the viewport, the rasterizer scissors that
+        const auto count = clipper.ClipTriangle(vertex(-2., 0., 0., 1.), vertex(0.5, 0., 0., 1.), vertex(0., 0.5, 0., 1.), polygon);
+        REQUIRE_EQ(count, 3);
+        CHECK_EQ(polygon[0].position[0], -2.);
+        CHECK_EQ(polygon[1].position[0], 0.5);
+        CHECK_EQ(polygon[2].position[1], 0.5);
+    }
+
+    TEST_CASE("A triangle outside of one viewport plane is rejected")
+    {
+        const auto clipper = Clipper();
+        auto polygon = Clipper::Polygon();
+        CHECK_EQ(clipper.ClipTriangle(vertex(1.5, 0., 0., 1.), vertex(2., 1., 0., 1.), vertex(3., -1., 0., 1.), polygon), 0);
+        CHECK_EQ(clipper.ClipTriangle(vertex(0., 0., 0., -1.), vertex(0.5, 0., 0., -1.), vertex(0., 0.5, 0., -1.), polygon), 0);
+        CHECK_EQ(clipper.ClipTriangle(vertex(0., 0., 2., 1.), vertex(0.5, 0., 3., 1.), vertex(0., 0.5, 2., 1.), polygon), 0);
+    }
+
+    TEST_CASE("A triangle crossing the near plane is clipped to the volume")
+    {
+        const auto clipper = Clipper();
+        const auto& volume = clipper.GetVolume();
+        auto polygon = Clipper::Polygon();
+        // one vertex behind the camera, its edges are cut where w = nearW and then by the guard band around it
+        const auto count = clipper.ClipTriangle(vertex(0., 0., 0., -1., 0.), vertex(0.5, 0., 0., 1., 1.), vertex(0., 0.5, 0., 1., 1.), polygon);
+        REQUIRE_GE(count, 3);
+        const auto eps = 1e-9;
+        auto kept = 0;
+        for (auto i = 0; i < count; i++)
+        {
+            const auto& p = polygon[i].position;
+            CHECK_GE(p[3], volume.nearW - eps);
+            CHECK_LE(std::abs(p[0]), volume.guardBand * p[3] + eps);
+            CHECK_LE(std::abs(p[1]), volume.guardBand * p[3] + eps);
+            CHECK_GE(p[2], volume.minZ * p[3] - eps);
+            CHECK_LE(p[2], volume.maxZ * p[3] + eps);
+            // the varyings follow the positions along the edges, here they are w mapped to [0, 1]
+            CHECK(std::abs(polygon[i].varyings[0] - (p[3] + 1.) / 2.) < 1e-9);
+            if (p[3] == 1.)
+                kept++;
+        }
+        // the two vertices in front of the camera are still there
+        CHECK_EQ(kept, 2);
+    }
+
+    TEST_CASE("A triangle leaving the guard band is cut at its edge")
+    {
+        const auto clipper = Clipper();
+        auto polygon = Clipper::Polygon();
+        const auto count = clipper.ClipTriangle(vertex(0., 0., 0., 1.), vertex(10., 0., 0., 1.), vertex(0., 1., 0., 1.), polygon);
+        REQUIRE_EQ(count, 4);
+        const auto guardBand = clipper.GetVolume().guardBand;
+        auto onEdge = 0;
+        for (auto i = 0; i < count; i++)
+        {
+            CHECK_LE(polygon[i].position[0], guardBand + 1e-12);
+            if (std::abs(polygon[i].position[0] - guardBand) < 1e-12)
+                onEdge++;
+        }
+        CHECK_EQ(onEdge, 2);
+    }
+
+    TEST_CASE("A triangle entirely behind the near plane is rejected")
+    {
+        const auto clipper = Clipper();
+        auto polygon = Clipper::Polygon();
+        // inside the viewport in x and y, so only the near plane clipping can drop it
+        CHECK_EQ(clipper.ClipTriangle(vertex(0., 0., 0., 1e-6), vertex(1e-7, 0., 0., 1e-6), vertex(0., 1e-7, 0., 1e-6), polygon), 0);
+    }
+
+    TEST_CASE("Only triangles without area are degenerate")
+    {
+        CHECK(IsDegenerate(Vec3f{ 0., 0., 0. }, Vec3f{ 1., 1., 0. }, Vec3f{ 2., 2., 0. }));
+        CHECK(IsDegenerate(Vec3f{ 3., 4., 0. }, Vec3f{ 3., 4., 0. }, Vec3f{ 7., 1., 0. }));
+        // a sliver far thinner than a pixel still crosses the pixel centers along it
+        CHECK_FALSE(IsDegenerate(Vec3f{ 0., 0.5, 0. }, Vec3f{ 100., 0.5, 0. }, Vec3f{ 0., 0.505, 0. }));
+    }
+}
@@ -0,0 +1,144 @@
+#include <doctest/doctest.h>
+
+#include <ColorOps.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    // every count up to a few SSE blocks, so the scalar tails get 0 to 3 colors, and a larger one
+    const size_t counts[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 15, 16, 17, 1027 };
+    const size_t maxCount = 1027;
+
+    struct Colors
+    {
+        std::vector<TGAColor> colors;
+        std::vector<TGAColor> under;
+        std::vector<double> intensities;
+
+        Colors()
+            : colors(maxCount + 1), under(maxCount + 1), intensities(maxCount + 1)
+        {
+            auto seed = 12345u;
+            for (size_t i = 0; i <= maxCount; i++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                colors[i].val = seed;
+                under[i].val = seed * 7u;
+                intensities[i] = (seed >> 8 & 0xffff) / 65535.;
+            }
+            // the extremes the rounding has to get right
+            colors[0] = TGAColor(255, 255, 255, 255);
+            colors[1] = TGAColor(255, 0, 128, 0);
+            intensities[2] = 1.;
+            intensities[3] = 0.;
+        }
+    };
+
+    bool same(const std::vector<TGAColor>& a, const std::vector<TGAColor>& b, size_t count)
+    {
+        return std::equal(a.begin(), a.begin() + count, b.begin(), [](const TGAColor& x, const TGAColor& y) { return x.val == y.val; });
+    }
+}
+
+TEST_SUITE("ColorOps tests")
+{
+    TEST_CASE("Div255 rounds to the nearest")
+    {
+        auto exact = true;
+        for (auto x = 0u; x <= 255u * 255u; x++)
+            exact &= ColorOps::Div255(x) == static_cast<unsigned int>(x / 255. + .5);
+        CHECK(exact);
+    }
+
+    TEST_CASE("ScaleIntensity matches the per channel products")
+    {
+        const auto input = Colors();
+        for (auto count : counts)
+        {
+            // from the second color on too, so the SSE loads aren't aligned
+            for (size_t offset = 0; offset < 2 && offset + count <= maxCount + 1; offset++)
+            {
+                auto expected = std::vector<TGAColor>(count);
+                for (size_t i = 0; i < count; i++)
+                {
+                    const auto& c = input.colors[offset + i];
+                    const auto intensity = input.intensities[offset + i];
+                    expected[i] = TGAColor(static_cast<unsigned char>(c.r * intensity), static_cast<unsigned char>(c.g * intensity),
+                        static_cast<unsigned char>(c.b * intensity), c.a);
+                }
+                auto batched = std::vector<TGAColor>(count);
+                ColorOps::ScaleIntensity(input.colors.data() + offset, input.intensities.data() + offset, batched.data(), count);
+                CHECK(same(expected, batched, count));
+            }
+        }
+    }
+
+    TEST_CASE("ScaleIntensity works in place")
+    {
+        const auto input = Colors();
+        auto expected = std::vector<TGAColor>(maxCount);
+        ColorOps::ScaleIntensity(input.colors.data(), input.intensities.data(), expected.data(), maxCount);
+        auto colors = input.colors;
+        ColorOps::ScaleIntensity(colors.data(), input.intensities.data(), colors.data(), maxCount);
+        CHECK(same(expected, colors, maxCount));
+    }
+
+    TEST_CASE("Swizzle matches the channel copies")
+    {
+        const auto input = Colors();
+        const int orders[][4] = { { 2, 1, 0, 3 }, { 0, 1, 2, 3 }, { 3, 3, 3, 3 }, { 3, 2, 1, 0 } };
+        for (const auto& order : orders)
+        {
+            for (auto count : counts)
+            {
+                auto expected = std::vector<TGAColor>(count);
+                for (size_t i = 0; i < count; i++)
+                    for (auto k = 0; k < 4; k++)
+                        expected[i].raw[k] = input.colors[i].raw[order[k]];
+                auto batched = std::vector<TGAColor>(count);
+                ColorOps::Swizzle(input.colors.data(), batched.data(), count, order);
+                CHECK(same(expected, batched, count));
+            }
+        }
+    }
+
+    TEST_CASE("Premultiply matches the rounded products")
+    {
+        const auto input = Colors();
+        for (auto count : counts)
+        {
+            auto expected = std::vector<TGAColor>(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                const auto& c = input.colors[i];
+                expected[i] = TGAColor(static_cast<unsigned char>(c.r * c.a / 255. + .5), static_cast<unsigned char>(c.g * c.a / 255. + .5),
+                    static_cast<unsigned char>(c.b * c.a / 255. + .5), c.a);
+            }
+            auto batched = std::vector<TGAColor>(count);
+            ColorOps::Premultiply(input.colors.data(), batched.data(), count);
+            CHECK(same(expected, batched, count));
+        }
+    }
+
+    TEST_CASE("BlendPremultiplied matches src over dst")
+    {
+        const auto input = Colors();
+        auto premultiplied = std::vector<TGAColor>(maxCount);
+        ColorOps::Premultiply(input.colors.data(), premultiplied.data(), maxCount);
+        for (auto count : counts)
+        {
+            auto expected = std::vector<TGAColor>(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                const auto& s = premultiplied[i];
+                for (auto k = 0; k < 4; k++)
+                    expected[i].raw[k] = static_cast<unsigned char>(std::min(255., s.raw[k] + input.under[i].raw[k] * (255 - s.a) / 255. + .5));
+            }
+            auto batched = std::vector<TGAColor>(input.under.begin(), input.under.begin() + count);
+            ColorOps::BlendPremultiplied(premultiplied.data(), batched.data(), count);
+            CHECK(same(expected, batched, count));
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#include <doctest/doctest.h>
+
+#include <ExportQueue.h>
+#include "TestUtils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // what the callbacks were told, from the writing threads
+    struct Reports
+    {
+        std::mutex mutex;
+        std::vector<std::pair<std::string, bool>> done;
+
+        ExportQueue::Callback Callback()
+        {
+            return [this](const std::string& path, bool written)
+            {
+                auto lock = std::lock_guard<std::mutex>(mutex);
+                done.emplace_back(path, written);
+            };
+        }
+    };
+}
+
+TEST_SUITE("ExportQueue tests")
+{
+    TEST_CASE("Every format is written and reported")
+    {
+        const std::pair<const char*, ExportQueue::Format> exports[] = {
+            { "export_queue.tga", ExportQueue::Format::Tga },
+            { "export_queue_rle.tga", ExportQueue::Format::TgaRle },
+            { "export_queue.qoi", ExportQueue::Format::Qoi },
+        };
+        auto reports = Reports();
+        {
+            // a single pending export for three submitted, so Submit has to wait for the writers
+            auto queue = ExportQueue(2, 1);
+            auto written = std::vector<std::future<bool>>();
+            for (auto i = 0; i < 3; i++)
+                written.push_back(queue.Submit(TestUtils::RandomImage(64, 48, TGAImage::RGB, 100u + i), exports[i].first, exports[i].second,
+                    reports.Callback()));
+            queue.Flush();
+            CHECK_EQ(queue.Pending(), 0u);
+            for (auto& w : written)
+                CHECK(w.get());
+        }
+
+        REQUIRE_EQ(reports.done.size(), 3u);
+        for (auto i = 0; i < 3; i++)
+        {
+            const auto* path = exports[i].first;
+            CHECK(std::find(reports.done.begin(), reports.done.end(), std::make_pair(std::string(path), true)) != reports.done.end());
+            auto read = TGAImage();
+            REQUIRE((exports[i].second == ExportQueue::Format::Qoi ? read.read_qoi_file(path) : read.read_tga_file(path)));
+            CHECK(TestUtils::SamePicture(read, TestUtils::RandomImage(64, 48, TGAImage::RGB, 100u + i)));
+            std::remove(path);
+        }
+    }
+
+    TEST_CASE("A failed write comes back through the future and the callback")
+    {
+        auto reports = Reports();
+        auto queue = ExportQueue();
+        const auto path = std::string("no_such_directory/frame.tga");
+        CHECK_FALSE(queue.Submit(TestUtils::RandomImage(8, 8, TGAImage::RGB, 8u), path, ExportQueue::Format::TgaRle,
+            reports.Callback()).get());
+        REQUIRE_EQ(reports.done.size(), 1u);
+        CHECK_EQ(reports.done[0].first, path);
+        CHECK_FALSE(reports.done[0].second);
+    }
+
+    TEST_CASE("A callback that throws fails its future, not the writing thread")
+    {
+        auto queue = ExportQueue(1, 1);
+        auto failed = queue.Submit(TestUtils::RandomImage(8, 8, TGAImage::RGB, 8u), "export_queue_throw.tga", ExportQueue::Format::TgaRle,
+            [](const std::string&, bool) { throw std::runtime_error("callback failed"); });
+        CHECK_THROWS_AS(failed.get(), std::runtime_error);
+
+        // the same thread takes the next export, and the pending count came back down
+        CHECK(queue.Submit(TestUtils::RandomImage(8, 8, TGAImage::RGB, 8u), "export_queue_after.tga").get());
+        queue.Flush();
+        CHECK_EQ(queue.Pending(), 0u);
+        std::remove("export_queue_throw.tga");
+        std::remove("export_queue_after.tga");
+    }
+
+    TEST_CASE("The exports still queued are written when the queue goes away")
+    {
+        const auto paths = { "export_queue_0.tga", "export_queue_1.tga", "export_queue_2.tga", "export_queue_3.tga" };
+        auto written = std::vector<std::future<bool>>();
+        {
+            auto queue = ExportQueue(1, 4);
+            for (const auto* path : paths)
+                written.push_back(queue.Submit(TestUtils::RandomImage(32, 32, TGAImage::RGB, 32u), path));
+        }
+        for (auto& w : written)
+            CHECK(w.get());
+        for (const auto* path : paths)
+            std::remove(path);
+    }
+}
@@ -0,0 +1,96 @@
+#include <doctest/doctest.h>
+
+#include <tgaimage.h>
+#include "TestUtils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+TEST_SUITE("QOI tests")
+{
+    TEST_CASE("Images round trip through memory")
+    {
+        for (auto bpp : { TGAImage::RGB, TGAImage::RGBA })
+        {
+            const auto image = TestUtils::RandomImage(123, 45, bpp, 99u);
+            auto encoded = std::vector<unsigned char>();
+            REQUIRE(image.encode_qoi(encoded));
+            auto decoded = TGAImage();
+            REQUIRE(decoded.decode_qoi(encoded.data(), encoded.size()));
+            CHECK(TestUtils::SamePicture(image, decoded));
+        }
+    }
+
+    TEST_CASE("Grayscale comes back as rgb")
+    {
+        const auto image = TestUtils::RandomImage(64, 32, TGAImage::GRAYSCALE, 5u);
+        auto encoded = std::vector<unsigned char>();
+        REQUIRE(image.encode_qoi(encoded));
+        auto decoded = TGAImage();
+        REQUIRE(decoded.decode_qoi(encoded.data(), encoded.size()));
+        REQUIRE_EQ(decoded.get_bytespp(), TGAImage::RGB);
+        auto same = true;
+        for (auto y = 0; y < image.get_height(); y++)
+        {
+            for (auto x = 0; x < image.get_width(); x++)
+            {
+                const auto gray = image.row(y)[x];
+                const auto* rgb = decoded.row(y) + x * 3;
+                same &= rgb[0] == gray && rgb[1] == gray && rgb[2] == gray;
+            }
+        }
+        CHECK(same);
+    }
+
+    TEST_CASE("Files round trip, bottom-up images included")
+    {
+        const auto filename = "qoi_round_trip.qoi";
+        for (auto bottomUp : { false, true })
+        {
+            auto image = TestUtils::RandomImage(300, 200, TGAImage::RGBA, 7u);
+            image.set_bottom_up(bottomUp);
+            REQUIRE(image.write_qoi_file(filename));
+            auto decoded = TGAImage();
+            REQUIRE(decoded.read_qoi_file(filename));
+            CHECK_FALSE(decoded.is_bottom_up());
+            CHECK(TestUtils::SamePicture(image, decoded));
+
+            // the file and the memory encoder agree
+            auto encoded = std::vector<unsigned char>();
+            REQUIRE(image.encode_qoi(encoded));
+            auto fromMemory = TGAImage();
+            REQUIRE(fromMemory.decode_qoi(encoded.data(), encoded.size()));
+            CHECK(TestUtils::SamePicture(decoded, fromMemory));
+        }
+        std::remove(filename);
+    }
+
+    TEST_CASE("A run pending at the end of a chunk fits in the next one")
+    {
+        // The writer encodes 65536 pixels at a time. The first row ends on a run, left pending, and every pixel
+        // of the second row is a full rgba op since the alpha alternates and no color comes back for the index:
+        // the second chunk needs 5 bytes per pixel plus the pending run.
+        const auto width = 65536;
+        auto image = TGAImage(width, 2, TGAImage::RGBA);
+        for (auto y = 0; y < 2; y++)
+        {
+            auto* row = image.row(y);
+            for (auto x = 0; x < width; x++)
+            {
+                // odd on the second row, so even its first pixel changes the alpha of the run before
+                const auto p = y == 0 ? std::min(x, width - 2) : width + 1 + x;
+                row[x * 4 + 0] = static_cast<unsigned char>(p);
+                row[x * 4 + 1] = static_cast<unsigned char>(p >> 8);
+                row[x * 4 + 2] = static_cast<unsigned char>(p >> 16);
+                row[x * 4 + 3] = p % 2 ? 255 : 0;
+            }
+        }
+        const auto filename = "qoi_pending_run.qoi";
+        REQUIRE(image.write_qoi_file(filename));
+        auto decoded = TGAImage();
+        REQUIRE(decoded.read_qoi_file(filename));
+        CHECK(TestUtils::SamePicture(image, decoded));
+        std::remove(filename);
+    }
+}
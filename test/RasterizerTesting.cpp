@@ -0,0 +1,151 @@
+#include <doctest/doctest.h>
+
+#include <Rasterizer.h>
+
+#include <vector>
+
+namespace
+{
+    const int Size = 32;
+
+    // how many times every pixel of a Size x Size screen was drawn
+    struct Coverage
+    {
+        std::vector<int> counts = std::vector<int>(Size * Size, 0);
+
+        void Draw(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3)
+        {
+            RasterizeFixedPoint(p1, p2, p3, Size, Size, [&](int x, int y, double, double, double)
+                {
+                    counts[y * Size + x]++;
+                });
+        }
+
+        int Total() const
+        {
+            auto total = 0;
+            for (auto count : counts)
+                total += count;
+            return total;
+        }
+
+        int Max() const
+        {
+            auto max = 0;
+            for (auto count : counts)
+                max = std::max(max, count);
+            return max;
+        }
+    };
+
+    // the floating point path: barycentric weights at the integer coordinates of the pixel
+    bool inside(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3, double x, double y)
+    {
+        const auto area = (p2.X() - p1.X()) * (p3.Y() - p1.Y()) - (p3.X() - p1.X()) * (p2.Y() - p1.Y());
+        const auto w1 = ((p2.X() - x) * (p3.Y() - y) - (p3.X() - x) * (p2.Y() - y)) / area;
+        const auto w2 = ((p3.X() - x) * (p1.Y() - y) - (p1.X() - x) * (p3.Y() - y)) / area;
+        return w1 > 0 && w2 > 0 && 1. - w1 - w2 > 0;
+    }
+}
+
+TEST_SUITE("Rasterizer tests")
+{
+    TEST_CASE("Fixed point covers the pixels the floating point path samples")
+    {
+        // on the subpixel grid, so nothing is snapped, and no edge through a sample point, so the fill rule
+        // doesn't come into it
+        const auto p1 = Vec3f{ 2.3125, 1.6875, 0. };
+        const auto p2 = Vec3f{ 27.625, 9.1875, 0. };
+        const auto p3 = Vec3f{ 8.0625, 29.4375, 0. };
+        auto coverage = Coverage();
+        coverage.Draw(p1, p2, p3);
+        for (auto y = 0; y < Size; y++)
+            for (auto x = 0; x < Size; x++)
+                CHECK_EQ(coverage.counts[y * Size + x], inside(p1, p2, p3, x, y) ? 1 : 0);
+    }
+
+    TEST_CASE("Both windings cover the same pixels")
+    {
+        const auto p1 = Vec3f{ 3.5, 2., 0. };
+        const auto p2 = Vec3f{ 20., 6.25, 0. };
+        const auto p3 = Vec3f{ 9., 25., 0. };
+        auto clockwise = Coverage();
+        auto counterClockwise = Coverage();
+        clockwise.Draw(p1, p2, p3);
+        counterClockwise.Draw(p1, p3, p2);
+        CHECK(clockwise.counts == counterClockwise.counts);
+        CHECK_GT(clockwise.Total(), 0);
+    }
+
+    TEST_CASE("Top-left rule draws shared edges once")
+    {
+        // a 24 x 24 square cut in 4 x 4 cells, each split along a diagonal: every edge goes through sample points
+        auto coverage = Coverage();
+        const auto cell = 6.;
+        for (auto j = 0; j < 4; j++)
+        {
+            for (auto i = 0; i < 4; i++)
+            {
+                const auto x0 = 4. + i * cell, y0 = 4. + j * cell;
+                const auto a = Vec3f{ x0, y0, 0. };
+                const auto b = Vec3f{ x0 + cell, y0, 0. };
+                const auto c = Vec3f{ x0 + cell, y0 + cell, 0. };
+                const auto d = Vec3f{ x0, y0 + cell, 0. };
+                coverage.Draw(a, b, c);
+                coverage.Draw(a, c, d);
+            }
+        }
+        CHECK_EQ(coverage.Max(), 1);
+        // no gaps either, only one of the two outer edges of each axis belongs to the square
+        CHECK_EQ(coverage.Total(), 24 * 24);
+    }
+
+    TEST_CASE("Weights are the fixed point edge functions over the area")
+    {
+        const auto p1 = Vec3f{ 4., 4., 0. };
+        const auto p2 = Vec3f{ 20., 4., 0. };
+        const auto p3 = Vec3f{ 4., 20., 0. };
+        auto fragments = 0;
+        RasterizeFixedPoint(p1, p2, p3, Size, Size, [&](int x, int y, double b1, double b2, double b3)
+            {
+                fragments++;
+                CHECK(std::abs(b1 + b2 + b3 - 1.) < 1e-12);
+                // the weights give back the sample point
+                CHECK(std::abs(b1 * p1.X() + b2 * p2.X() + b3 * p3.X() - x) < 1e-9);
+                CHECK(std::abs(b1 * p1.Y() + b2 * p2.Y() + b3 * p3.Y() - y) < 1e-9);
+            });
+        CHECK_GT(fragments, 0);
+    }
+
+    TEST_CASE("Edge functions step by whole pixels")
+    {
+        using namespace FixedPoint;
+        const auto a = Point{ ToFixed(1.), ToFixed(2.) };
+        const auto b = Point{ ToFixed(5.5), ToFixed(7.25) };
+        const auto origin = Point{ 3 << SubpixelBits, 4 << SubpixelBits };
+        const auto edge = Edge(a, b, 1, origin);
+        CHECK_EQ(edge.stepX, -(b.y - a.y) * SubpixelScale);
+        CHECK_EQ(edge.stepY, (b.x - a.x) * SubpixelScale);
+        CHECK_EQ(edge.row - edge.bias, (b.x - a.x) * (origin.y - a.y) - (b.y - a.y) * (origin.x - a.x));
+        // flipped, the inside changes sides
+        const auto flipped = Edge(a, b, -1, origin);
+        CHECK_EQ(flipped.row - flipped.bias, -(edge.row - edge.bias));
+    }
+
+    TEST_CASE("Only the pixels in the scissor rectangle are drawn")
+    {
+        const auto scissor = PixelRect{ 8, 10, 15, 12 };
+        auto outside = 0;
+        auto drawn = 0;
+        const auto tested = RasterizeFixedPoint(Vec3f{ 0., 0., 0. }, Vec3f{ 31., 0., 0. }, Vec3f{ 0., 31., 0. }, scissor,
+            [&](int x, int y, double, double, double)
+            {
+                drawn++;
+                if (x < scissor.minX || x > scissor.maxX || y < scissor.minY || y > scissor.maxY)
+                    outside++;
+            });
+        CHECK_EQ(outside, 0);
+        CHECK_EQ(drawn, static_cast<int>(scissor.Area()));
+        CHECK_EQ(tested, static_cast<uint64_t>(scissor.Area()));
+    }
+}
@@ -1,7 +1,12 @@
 #ifndef TestUtils_h_include
 #define TestUtils_h_include
 
+#include "../tiny_renderer/tgaimage.h"
+
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
+#include <ostream>
 #include <utility>
 
 namespace TestUtils
@@ -17,6 +22,96 @@ namespace TestUtils
 		return std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
 	}
 
+	// seconds per call of func, averaged over repeats calls
+	template <typename F>
+	double Measure(int repeats, F&& func)
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+			func();
+		auto t1 = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double>(t1 - t0).count() / repeats;
+	}
+
+	// Runs of random lengths up to maxRun and random colors between stretches of noise, some of it only 0 and 1
+	// per channel: every kind of RLE chunk and QOI op comes up. With maxRun 1 nearly every pixel is its own.
+	inline TGAImage RandomImage(int width, int height, int bpp, unsigned seed, int maxRun = 300)
+	{
+		auto image = TGAImage(width, height, bpp);
+		auto* pixels = image.buffer();
+		const auto npixels = static_cast<size_t>(width) * height;
+		auto next = [&seed]() { return seed = seed * 1664525u + 1013904223u; };
+		for (size_t p = 0; p < npixels;)
+		{
+			const auto kind = next() >> 29;
+			const auto length = std::min<size_t>(1 + (next() >> 24) % maxRun, npixels - p);
+			unsigned char color[4] = { static_cast<unsigned char>(next() >> 24), static_cast<unsigned char>(next() >> 24),
+				static_cast<unsigned char>(next() >> 24), static_cast<unsigned char>(next() >> 24) };
+			for (size_t k = 0; k < length; k++, p++)
+			{
+				for (auto c = 0; c < bpp; c++)
+					pixels[p * bpp + c] = kind < 4 ? color[c] : static_cast<unsigned char>(next() >> 24 & (kind == 7 ? 1 : 0xff));
+			}
+		}
+		return image;
+	}
+
+	// the same picture as displayed, whatever the row order each image stores
+	inline bool SamePicture(const TGAImage& a, const TGAImage& b)
+	{
+		if (a.get_width() != b.get_width() || a.get_height() != b.get_height() || a.get_bytespp() != b.get_bytespp())
+			return false;
+		const auto height = a.get_height();
+		const auto rowBytes = static_cast<size_t>(a.get_width()) * a.get_bytespp();
+		for (auto y = 0; y < height; y++)
+		{
+			const auto* rowA = a.row(a.is_bottom_up() ? height - 1 - y : y);
+			const auto* rowB = b.row(b.is_bottom_up() ? height - 1 - y : y);
+			if (!std::equal(rowA, rowA + rowBytes, rowB))
+				return false;
+		}
+		return true;
+	}
+
+	// The byte by byte RLE encoder write_tga_file used before it looked for runs a chunk at a time, the pixel data
+	// only, without the header. The tests check the chunks written now against it, the benchmark their speed.
+	inline bool LegacyRle(const TGAImage& image, std::ostream& out)
+	{
+		const auto* data = image.buffer();
+		const auto bytespp = image.get_bytespp();
+		const unsigned char max_chunk_length = 128;
+		const unsigned long npixels = image.get_width() * image.get_height();
+		unsigned long curpix = 0;
+		while (curpix < npixels) {
+			unsigned long chunkstart = curpix * bytespp;
+			unsigned long curbyte = curpix * bytespp;
+			unsigned char run_length = 1;
+			bool raw = true;
+			while (curpix + run_length < npixels && run_length < max_chunk_length) {
+				bool succ_eq = true;
+				for (int t = 0; succ_eq && t < bytespp; t++) {
+					succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
+				}
+				curbyte += bytespp;
+				if (1 == run_length) {
+					raw = !succ_eq;
+				}
+				if (raw && succ_eq) {
+					run_length--;
+					break;
+				}
+				if (!raw && !succ_eq) {
+					break;
+				}
+				run_length++;
+			}
+			curpix += run_length;
+			out.put(raw ? run_length - 1 : run_length + 127);
+			out.write((const char*)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
+		}
+		return out.good();
+	}
+
 	class Timer
 	{
 	public:
@@ -31,6 +126,12 @@ namespace TestUtils
 			return std::chrono::duration_cast<std::chrono::milliseconds>(t1 - m_t0).count();
 		}
 
+		double Seconds() const
+		{
+			auto t1 = std::chrono::high_resolution_clock::now();
+			return std::chrono::duration<double>(t1 - m_t0).count();
+		}
+
 	private:
 		TimePoint m_t0 = std::chrono::high_resolution_clock::now();
 	};
@@ -0,0 +1,58 @@
+#include <doctest/doctest.h>
+
+#include <Texture.h>
+#include "TestUtils.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+    // the scalar 2x2 box filter: every channel of the four texels summed and rounded to the nearest
+    uint32_t boxFilter(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+    {
+        auto result = 0u;
+        for (auto shift = 0; shift < 32; shift += 8)
+        {
+            const auto sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff) + ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+            result |= ((sum + 2) / 4) << shift;
+        }
+        return result;
+    }
+}
+
+TEST_SUITE("Texture tests")
+{
+    TEST_CASE("Every column of a mip level is filtered the same")
+    {
+        // odd widths, so a level has SSE2 columns and scalar ones
+        for (auto width : { 37, 45, 64 })
+        {
+            const auto image = TestUtils::RandomImage(width, 21, TGAImage::RGBA, 4321u + width, 1);
+            for (auto layout : { Texture::Layout::Linear, Texture::Layout::Tiled4x4 })
+            {
+                const auto texture = Texture(image, layout);
+                REQUIRE_GT(texture.Levels(), 1);
+                auto exact = true;
+                for (auto level = 1; level < texture.Levels(); level++)
+                {
+                    const auto srcWidth = texture.Width(level - 1);
+                    const auto srcHeight = texture.Height(level - 1);
+                    for (auto y = 0; y < texture.Height(level); y++)
+                    {
+                        for (auto x = 0; x < texture.Width(level); x++)
+                        {
+                            // odd sizes drop the last row and column, a side of 1 repeats its texel
+                            const auto x0 = std::min(2 * x, srcWidth - 1), x1 = std::min(2 * x + 1, srcWidth - 1);
+                            const auto y0 = std::min(2 * y, srcHeight - 1), y1 = std::min(2 * y + 1, srcHeight - 1);
+                            const auto expected = boxFilter(texture.Fetch(x0, y0, level - 1).val, texture.Fetch(x1, y0, level - 1).val,
+                                texture.Fetch(x0, y1, level - 1).val, texture.Fetch(x1, y1, level - 1).val);
+                            exact &= texture.Fetch(x, y, level).val == expected;
+                        }
+                    }
+                }
+                CHECK(exact);
+            }
+        }
+    }
+}
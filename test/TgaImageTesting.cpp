@@ -0,0 +1,309 @@
+#include <doctest/doctest.h>
+
+#include <tgaimage.h>
+#include "TestUtils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+    const size_t headerSize = 18;
+
+    // the chunks of the legacy encoder, the reference for the ones write_tga_file writes now
+    std::vector<unsigned char> legacyRle(const TGAImage& image)
+    {
+        auto out = std::ostringstream();
+        TestUtils::LegacyRle(image, out);
+        const auto chunks = out.str();
+        return std::vector<unsigned char>(chunks.begin(), chunks.end());
+    }
+
+    std::vector<unsigned char> readFile(const char* filename)
+    {
+        auto in = std::ifstream(filename, std::ios::binary);
+        return std::vector<unsigned char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // result(x, y) is source(from(x, y)) for every stored pixel of result
+    bool mapsPixels(const TGAImage& result, const TGAImage& source, int width, int height,
+        const std::function<std::pair<int, int>(int, int)>& from)
+    {
+        const auto bpp = source.get_bytespp();
+        if (result.get_width() != width || result.get_height() != height || result.get_bytespp() != bpp)
+            return false;
+        for (auto y = 0; y < height; y++)
+        {
+            for (auto x = 0; x < width; x++)
+            {
+                const auto p = from(x, y);
+                if (!std::equal(result.row(y) + x * bpp, result.row(y) + (x + 1) * bpp, source.row(p.second) + p.first * bpp))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // where the pixels are, without the copy buffer() makes of a view
+    const unsigned char* pixelsOf(const TGAImage& image)
+    {
+        return image.buffer();
+    }
+
+    // sizes under, at and over the 32 x 32 tiles of transpose, square or not
+    const std::pair<int, int> transformSizes[] = { { 1, 1 }, { 7, 7 }, { 32, 32 }, { 37, 37 }, { 64, 64 }, { 45, 19 }, { 19, 45 }, { 100, 33 } };
+}
+
+TEST_SUITE("TGAImage RLE tests")
+{
+    TEST_CASE("A single band encodes to the bytes of the legacy encoder")
+    {
+        const auto filename = "rle_single_band.tga";
+        for (auto bpp : { TGAImage::GRAYSCALE, TGAImage::RGB, TGAImage::RGBA })
+        {
+            for (auto size : { 1, 7, 129, 300 })
+            {
+                auto image = TestUtils::RandomImage(size, size / 2 + 1, bpp, 77u + size);
+                REQUIRE(image.write_tga_file(filename, true));
+                const auto written = readFile(filename);
+                const auto reference = legacyRle(image);
+                REQUIRE_GE(written.size(), headerSize + reference.size());
+                CHECK(std::equal(reference.begin(), reference.end(), written.begin() + headerSize));
+            }
+        }
+        std::remove(filename);
+    }
+
+    TEST_CASE("Uniform and alternating images encode to the bytes of the legacy encoder")
+    {
+        const auto filename = "rle_extremes.tga";
+        auto uniform = TGAImage(333, 200, TGAImage::RGB);
+        uniform.fill_span(0, 0, 333, TGAColor(10, 20, 30, 255));
+        for (auto y = 1; y < 200; y++)
+            uniform.copy_span(0, y, 333, uniform.row(0));
+        auto alternating = TGAImage(333, 200, TGAImage::RGBA);
+        for (auto y = 0; y < 200; y++)
+            for (auto x = 0; x < 333; x++)
+                alternating.set(x, y, (x + y) % 2 ? TGAColor(255, 255, 255, 255) : TGAColor(0, 0, 0, 0));
+        for (auto* image : { &uniform, &alternating })
+        {
+            REQUIRE(image->write_tga_file(filename, true));
+            const auto written = readFile(filename);
+            const auto reference = legacyRle(*image);
+            REQUIRE_GE(written.size(), headerSize + reference.size());
+            CHECK(std::equal(reference.begin(), reference.end(), written.begin() + headerSize));
+        }
+        std::remove(filename);
+    }
+
+    TEST_CASE("Bands come out the same whatever the thread count and decode back")
+    {
+        // over a million pixels, so cut in bands
+        auto image = TestUtils::RandomImage(1500, 1000, TGAImage::RGB, 1234u);
+        REQUIRE(image.write_tga_file("rle_one_thread.tga", true, 1));
+        REQUIRE(image.write_tga_file("rle_threads.tga", true, 4));
+        const auto single = readFile("rle_one_thread.tga");
+        CHECK(single == readFile("rle_threads.tga"));
+
+        auto decoded = TGAImage();
+        auto mapped = TGAImage();
+        REQUIRE(decoded.read_tga_file("rle_one_thread.tga"));
+        REQUIRE(mapped.map_tga_file("rle_one_thread.tga"));
+        CHECK(TestUtils::SamePicture(image, decoded));
+        CHECK(TestUtils::SamePicture(image, mapped));
+        mapped = TGAImage();
+        std::remove("rle_one_thread.tga");
+        std::remove("rle_threads.tga");
+    }
+}
+
+TEST_SUITE("TGAImage transform tests")
+{
+    TEST_CASE("Flips and transpose move every stored pixel where it belongs")
+    {
+        for (auto bpp : { TGAImage::GRAYSCALE, TGAImage::RGB, TGAImage::RGBA })
+        {
+            for (const auto& size : transformSizes)
+            {
+                const auto w = size.first, h = size.second;
+                const auto source = TestUtils::RandomImage(w, h, bpp, 31u * w + h, 1);
+                CAPTURE(bpp);
+                CAPTURE(w);
+                CAPTURE(h);
+
+                auto flipped = source;
+                REQUIRE(flipped.flip_horizontally());
+                CHECK(mapsPixels(flipped, source, w, h, [&](int x, int y) { return std::make_pair(w - 1 - x, y); }));
+
+                flipped = source;
+                REQUIRE(flipped.flip_vertically());
+                CHECK(mapsPixels(flipped, source, w, h, [&](int x, int y) { return std::make_pair(x, h - 1 - y); }));
+
+                auto transposed = source;
+                REQUIRE(transposed.transpose());
+                CHECK(mapsPixels(transposed, source, h, w, [](int x, int y) { return std::make_pair(y, x); }));
+            }
+        }
+    }
+
+    TEST_CASE("rotate_90 turns the picture as it is displayed, bottom-up images included")
+    {
+        for (auto bpp : { TGAImage::GRAYSCALE, TGAImage::RGB, TGAImage::RGBA })
+        {
+            for (const auto& size : transformSizes)
+            {
+                for (auto bottomUp : { false, true })
+                {
+                    const auto w = size.first, h = size.second;
+                    auto source = TestUtils::RandomImage(w, h, bpp, 17u * w + h, 1);
+                    source.set_bottom_up(bottomUp);
+                    CAPTURE(bpp);
+                    CAPTURE(w);
+                    CAPTURE(h);
+                    CAPTURE(bottomUp);
+                    // displayed (x, y) is stored row y of a top-down image, row height - 1 - y of a bottom-up one
+                    const auto stored = [bottomUp](int height, int x, int y) { return std::make_pair(x, bottomUp ? height - 1 - y : y); };
+
+                    auto clockwise = source;
+                    REQUIRE(clockwise.rotate_90(true));
+                    CHECK_EQ(clockwise.is_bottom_up(), bottomUp);
+                    // the left column, read bottom to top, becomes the top row
+                    CHECK(mapsPixels(clockwise, source, h, w, [&](int x, int y)
+                        {
+                            const auto p = stored(w, x, y);
+                            return stored(h, p.second, h - 1 - p.first);
+                        }));
+
+                    auto counterClockwise = source;
+                    REQUIRE(counterClockwise.rotate_90(false));
+                    CHECK(mapsPixels(counterClockwise, source, h, w, [&](int x, int y)
+                        {
+                            const auto p = stored(w, x, y);
+                            return stored(h, w - 1 - p.second, p.first);
+                        }));
+                }
+            }
+        }
+    }
+}
+
+TEST_SUITE("TGAImage buffer tests")
+{
+    TEST_CASE("Moving takes the pixels and leaves the source empty")
+    {
+        auto source = TestUtils::RandomImage(40, 30, TGAImage::RGB, 3u);
+        source.set_bottom_up(true);
+        const auto reference = source;
+        const auto* pixels = pixelsOf(source);
+        const auto allocations = TGAImage::buffer_allocations();
+
+        auto moved = TGAImage(std::move(source));
+        CHECK_EQ(pixelsOf(moved), pixels);
+        CHECK(moved.is_bottom_up());
+        CHECK(TestUtils::SamePicture(moved, reference));
+        CHECK(pixelsOf(source) == nullptr);
+        CHECK_EQ(source.get_width(), 0);
+        CHECK_EQ(source.get_height(), 0);
+        CHECK_EQ(TGAImage::buffer_allocations(), allocations);
+
+        // an emptied image can be given pixels again
+        source = TGAImage(5, 5, TGAImage::GRAYSCALE);
+        CHECK_EQ(source.get_width(), 5);
+    }
+
+    TEST_CASE("Move assignment releases the pixels it had and takes the others")
+    {
+        auto target = TestUtils::RandomImage(16, 16, TGAImage::RGBA, 4u);
+        auto source = TestUtils::RandomImage(40, 30, TGAImage::RGB, 5u);
+        const auto reference = source;
+        const auto* pixels = pixelsOf(source);
+        const auto allocations = TGAImage::buffer_allocations();
+
+        target = std::move(source);
+        CHECK_EQ(pixelsOf(target), pixels);
+        CHECK(TestUtils::SamePicture(target, reference));
+        CHECK(pixelsOf(source) == nullptr);
+        CHECK_EQ(source.get_width(), 0);
+        CHECK_EQ(TGAImage::buffer_allocations(), allocations);
+
+        // moving into itself keeps the image
+        auto& self = target;
+        target = std::move(self);
+        CHECK_EQ(pixelsOf(target), pixels);
+        CHECK(TestUtils::SamePicture(target, reference));
+    }
+
+    TEST_CASE("A moved view stays a view of the mapping")
+    {
+        const auto filename = "move_view.tga";
+        const auto image = TestUtils::RandomImage(64, 32, TGAImage::RGB, 6u);
+        REQUIRE(TGAImage(image).write_tga_file(filename, false));
+        {
+            auto view = TGAImage();
+            REQUIRE(view.map_tga_file(filename));
+            REQUIRE(view.is_view());
+            auto moved = TGAImage(std::move(view));
+            CHECK(moved.is_view());
+            CHECK_FALSE(view.is_view());
+            auto assigned = TGAImage();
+            assigned = std::move(moved);
+            CHECK(assigned.is_view());
+            CHECK(TestUtils::SamePicture(assigned, image));
+        }
+        std::remove(filename);
+    }
+
+    TEST_CASE("Images of the same size reuse the pooled buffers")
+    {
+        auto pool = TGABufferPool();
+        TGAImage::set_buffer_pool(&pool);
+        const auto nbytes = 100ul * 80 * 3;
+        {
+            auto first = TGAImage(100, 80, TGAImage::RGB);
+            const auto* pixels = pixelsOf(first);
+            first.fill_span(0, 79, 100, TGAColor(1, 2, 3, 255));
+            first = TGAImage();
+            CHECK_EQ(pool.held_bytes(), nbytes);
+
+            // the next image of that size gets the buffer back, cleared
+            const auto allocations = TGAImage::buffer_allocations();
+            {
+                auto second = TGAImage(100, 80, TGAImage::RGB);
+                CHECK_EQ(pixelsOf(second), pixels);
+                CHECK_EQ(second.get(99, 79).val & 0xffffff, 0u);
+                CHECK_EQ(TGAImage::buffer_allocations(), allocations);
+            }
+
+            // frame after frame, an image and its copy: only the first copy comes from the heap
+            for (auto frame = 0; frame < 10; frame++)
+            {
+                auto image = TGAImage(100, 80, TGAImage::RGB);
+                image.fill_span(0, 79, 100, TGAColor(1, 2, 3, 255));
+                auto copy = image;
+                CHECK(TestUtils::SamePicture(copy, image));
+            }
+            CHECK_EQ(TGAImage::buffer_allocations(), allocations + 1);
+
+            // another size still comes from the heap
+            auto other = TGAImage(80, 100, TGAImage::RGBA);
+            CHECK_EQ(TGAImage::buffer_allocations(), allocations + 2);
+        }
+        CHECK_EQ(pool.held_bytes(), 2 * nbytes + 80ul * 100 * 4);
+
+        // a pool holds no more than its limit, the buffers over it go back to the heap
+        auto small = TGABufferPool(nbytes);
+        TGAImage::set_buffer_pool(&small);
+        {
+            auto a = TGAImage(100, 80, TGAImage::RGB);
+            auto b = TGAImage(100, 80, TGAImage::RGB);
+        }
+        CHECK_EQ(small.held_bytes(), nbytes);
+
+        TGAImage::set_buffer_pool(nullptr);
+    }
+}
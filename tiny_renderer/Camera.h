@@ -0,0 +1,79 @@
+#ifndef Camera_h_include
+#define Camera_h_include
+
+#include <VecN.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+using namespace MathLib;
+
+// 4x4 row-major matrix on plain doubles, the per vertex transforms should not allocate like Mat4 does
+using Transform4 = std::array<double, 16>;
+
+inline Transform4 Multiply(const Transform4& lhs, const Transform4& rhs)
+{
+    auto result = Transform4();
+    for (auto row = 0; row < 4; row++)
+        for (auto col = 0; col < 4; col++)
+            for (auto k = 0; k < 4; k++)
+                result[row * 4 + col] += lhs[row * 4 + k] * rhs[k * 4 + col];
+    return result;
+}
+
+// Looks from eye at center, the same central projection as african_head with the focal distance |eye - center|.
+// The default camera is exactly the african_head one.
+struct Camera
+{
+    Vec3f eye{ 0., 0., 5. };
+    Vec3f center{ 0., 0., 0. };
+    Vec3f up{ 0., 1., 0. };
+
+    // towards the camera, for the back face culling
+    Vec3f Direction() const
+    {
+        auto z = eye - center;
+        z.Normalize();
+        return z;
+    }
+
+    Transform4 View() const
+    {
+        // Cross is not const in MathLib
+        auto z = Direction();
+        auto x = Vec3f(up).Cross(z);
+        x.Normalize();
+        const auto y = z.Cross(x);
+        return { x.X(), x.Y(), x.Z(), -x.Dot(center),
+                 y.X(), y.Y(), y.Z(), -y.Dot(center),
+                 z.X(), z.Y(), z.Z(), -z.Dot(center),
+                 0., 0., 0., 1. };
+    }
+
+    Transform4 Projection() const
+    {
+        const auto distance = eye - center;
+        return { 1., 0., 0., 0.,
+                 0., 1., 0., 0.,
+                 0., 0., 1., 0.,
+                 0., 0., -1. / std::sqrt(distance.Dot(distance)), 1. };
+    }
+
+    Transform4 ViewProjection() const
+    {
+        return Multiply(Projection(), View());
+    }
+};
+
+// [-1, 1] to the centered three quarters of the image, z to [0, depth]
+inline Transform4 Viewport(int width, int height, double depth = 255.)
+{
+    const auto size = std::min(width, height) * 3. / 4.;
+    return { size / 2., 0., 0., width / 2.,
+             0., size / 2., 0., height / 2.,
+             0., 0., depth / 2., depth / 2.,
+             0., 0., 0., 1. };
+}
+
+#endif
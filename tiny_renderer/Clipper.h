@@ -0,0 +1,176 @@
+#ifndef Clipper_h_include
+#define Clipper_h_include
+
+#include <VecN.h>
+
+#include <array>
+#include <cmath>
+
+using namespace MathLib;
+
+// vertex in homogeneous clip space, before the perspective divide
+// varyings are interpolated linearly along the clipped edges (uv, normals, intensity...)
+struct ClipVertex
+{
+    static constexpr int MaxVaryings = 8;
+
+    Vec4f position;
+    std::array<double, MaxVaryings> varyings{};
+};
+
+// Clips triangles against the near/far planes and a guard band, all in homogeneous space.
+// x and y are only clipped when a triangle leaves the guard band, which is wider than the viewport:
+// anything inside it is left to the rasterizer's scissor (the bounding box clamp) since that is much
+// cheaper than generating new vertices. w is clipped against nearW so nothing behind the camera
+// ever reaches the perspective divide.
+class Clipper
+{
+public:
+    struct Volume
+    {
+        double minZ = -1.;
+        double maxZ = 1.;
+        double nearW = 1e-5;
+        double guardBand = 4.; // in viewport widths, i.e. |x| <= guardBand * w
+    };
+
+    // 3 vertices + at most one new vertex for each plane
+    static constexpr int PlaneCount = 7;
+    static constexpr int MaxPolygonVertices = 3 + PlaneCount;
+    using Polygon = std::array<ClipVertex, MaxPolygonVertices>;
+
+    Clipper() = default;
+    Clipper(const Volume& volume)
+        :m_volume(volume)
+    {
+    }
+
+    // returns the number of vertices of the clipped convex polygon, 0 if the triangle was rejected
+    // the polygon can be drawn as a fan around polygon[0]
+    int ClipTriangle(const ClipVertex& v1, const ClipVertex& v2, const ClipVertex& v3, Polygon& polygon) const
+    {
+        const auto c1 = outcode(v1.position);
+        const auto c2 = outcode(v2.position);
+        const auto c3 = outcode(v3.position);
+
+        // all vertices are on the outside of the same plane, nothing can be visible
+        if (c1.viewport & c2.viewport & c3.viewport)
+            return 0;
+
+        polygon[0] = v1;
+        polygon[1] = v2;
+        polygon[2] = v3;
+        auto count = 3;
+
+        // the common case, nothing outside of the guard band
+        const auto clipMask = c1.clip | c2.clip | c3.clip;
+        if (!clipMask)
+            return count;
+
+        auto scratch = Polygon();
+        auto* input = &polygon;
+        auto* output = &scratch;
+        for (auto plane = 0; plane < PlaneCount && count > 0; plane++)
+        {
+            if (!(clipMask & (1 << plane)))
+                continue;
+            count = clipAgainstPlane(plane, *input, count, *output);
+            std::swap(input, output);
+        }
+
+        if (input != &polygon)
+            std::copy(input->begin(), input->begin() + count, polygon.begin());
+        return count < 3 ? 0 : count;
+    }
+
+    const Volume& GetVolume() const
+    {
+        return m_volume;
+    }
+
+private:
+    struct Outcode
+    {
+        int clip;       // planes the vertex is outside of and that we actually clip against
+        int viewport;   // planes used for trivial rejection, the guard band replaced by the viewport
+    };
+
+    double distance(int plane, const Vec4f& p) const
+    {
+        const auto w = p[3];
+        const auto gb = m_volume.guardBand * w;
+        switch (plane)
+        {
+        case 0: return w - m_volume.nearW;
+        case 1: return p[2] - m_volume.minZ * w;
+        case 2: return m_volume.maxZ * w - p[2];
+        case 3: return gb + p[0];
+        case 4: return gb - p[0];
+        case 5: return gb + p[1];
+        default: return gb - p[1];
+        }
+    }
+
+    Outcode outcode(const Vec4f& p) const
+    {
+        auto code = Outcode{ 0, 0 };
+        for (auto plane = 0; plane < PlaneCount; plane++)
+        {
+            if (distance(plane, p) < 0)
+                code.clip |= 1 << plane;
+        }
+
+        const auto w = p[3];
+        code.viewport = code.clip & 0b111;
+        if (p[0] < -w) code.viewport |= 1 << 3;
+        if (p[0] > w) code.viewport |= 1 << 4;
+        if (p[1] < -w) code.viewport |= 1 << 5;
+        if (p[1] > w) code.viewport |= 1 << 6;
+        return code;
+    }
+
+    static ClipVertex lerp(const ClipVertex& a, const ClipVertex& b, double t)
+    {
+        auto result = ClipVertex();
+        for (auto i = 0; i < 4; i++)
+            result.position[i] = a.position[i] + (b.position[i] - a.position[i]) * t;
+        for (auto i = 0; i < ClipVertex::MaxVaryings; i++)
+            result.varyings[i] = a.varyings[i] + (b.varyings[i] - a.varyings[i]) * t;
+        return result;
+    }
+
+    // Sutherland-Hodgman against a single plane
+    int clipAgainstPlane(int plane, const Polygon& input, int count, Polygon& output) const
+    {
+        auto outCount = 0;
+        auto previous = count - 1;
+        auto previousDistance = distance(plane, input[previous].position);
+        for (auto current = 0; current < count; current++)
+        {
+            const auto currentDistance = distance(plane, input[current].position);
+            if ((previousDistance >= 0) != (currentDistance >= 0))
+            {
+                const auto t = previousDistance / (previousDistance - currentDistance);
+                output[outCount++] = lerp(input[previous], input[current], t);
+            }
+            if (currentDistance >= 0)
+                output[outCount++] = input[current];
+
+            previous = current;
+            previousDistance = currentDistance;
+        }
+        return outCount;
+    }
+
+    Volume m_volume;
+};
+
+// twice the signed screen space area, only a triangle with no area at all is dropped here: a thin sliver can
+// still cover pixel centers, which is for the rasterizer to decide
+inline bool IsDegenerate(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3)
+{
+    const auto area = (p2.X() - p1.X()) * (p3.Y() - p1.Y()) - (p3.X() - p1.X()) * (p2.Y() - p1.Y());
+    return area == 0.;
+}
+
+#endif
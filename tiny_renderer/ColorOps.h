@@ -0,0 +1,194 @@
+#ifndef ColorOps_h_include
+#define ColorOps_h_include
+
+#include "tgaimage.h"
+#include "Simd.h"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Batch operations on 4 byte b g r a colors: TGAColors, RGBA8 rows and texels all share the layout.
+// SSE2 does four colors at a time, the scalar code does the rest and gives the exact same bytes.
+static_assert(sizeof(TGAColor) == 4 && sizeof(RGBA8) == 4, "colors must be packed in 4 bytes");
+
+namespace ColorOps
+{
+    // x / 255 rounded to the nearest, exact for x in [0, 255 * 255]
+    inline unsigned int Div255(unsigned int x)
+    {
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+#if TR_SSE2
+    inline __m128i Div255(__m128i x)
+    {
+        x = _mm_add_epi16(x, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    // the alpha of both colors held in 16 bit lanes copied to their four channels
+    inline __m128i BroadcastAlpha(__m128i colors)
+    {
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(colors, 0xff), 0xff);
+    }
+#endif
+
+    // dst[i] is src[i] with b, g and r multiplied by intensity[i] and truncated, like (unsigned char)(c.r * intensity),
+    // alpha is kept. The products are done on doubles so the results match the scalar shading to the bit.
+    inline void ScaleIntensity(const TGAColor* src, const double* intensity, TGAColor* dst, size_t count)
+    {
+        size_t simdCount = 0;
+#if TR_SSE2
+        simdCount = count - count % 4;
+        const auto zero = _mm_setzero_si128();
+        for (size_t i = 0; i < simdCount; i += 4)
+        {
+            const auto colors = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const auto low = _mm_unpacklo_epi8(colors, zero);
+            const auto high = _mm_unpackhi_epi8(colors, zero);
+            const __m128i channels[4] = { _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+                _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero) };
+            __m128i scaled[4];
+            for (auto k = 0; k < 4; k++)
+            {
+                const auto bg = _mm_mul_pd(_mm_cvtepi32_pd(channels[k]), _mm_set1_pd(intensity[i + k]));
+                const auto ra = _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(channels[k], 8)), _mm_set_pd(1., intensity[i + k]));
+                scaled[k] = _mm_unpacklo_epi64(_mm_cvttpd_epi32(bg), _mm_cvttpd_epi32(ra));
+            }
+            const auto packed = _mm_packus_epi16(_mm_packs_epi32(scaled[0], scaled[1]), _mm_packs_epi32(scaled[2], scaled[3]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+        }
+#endif
+        for (size_t i = simdCount; i < count; i++)
+        {
+            const auto c = src[i];
+            dst[i] = TGAColor(static_cast<unsigned char>(c.r * intensity[i]), static_cast<unsigned char>(c.g * intensity[i]),
+                static_cast<unsigned char>(c.b * intensity[i]), c.a);
+        }
+    }
+
+    // dst[i] channel k is src[i] channel order[k], { 2, 1, 0, 3 } turns b g r a into r g b a and back
+    inline void Swizzle(const TGAColor* src, TGAColor* dst, size_t count, const int order[4])
+    {
+        size_t simdCount = 0;
+#if TR_SSE2
+        simdCount = count - count % 4;
+        const auto mask = _mm_set1_epi32(0xff);
+        for (size_t i = 0; i < simdCount; i += 4)
+        {
+            const auto colors = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            auto swizzled = _mm_setzero_si128();
+            for (auto k = 0; k < 4; k++)
+            {
+                const auto channel = _mm_and_si128(_mm_srl_epi32(colors, _mm_cvtsi32_si128(8 * order[k])), mask);
+                swizzled = _mm_or_si128(swizzled, _mm_sll_epi32(channel, _mm_cvtsi32_si128(8 * k)));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), swizzled);
+        }
+#endif
+        for (size_t i = simdCount; i < count; i++)
+        {
+            const auto c = src[i];
+            auto swizzled = TGAColor();
+            for (auto k = 0; k < 4; k++)
+                swizzled.raw[k] = c.raw[order[k]];
+            dst[i] = swizzled;
+        }
+    }
+
+    // b, g and r multiplied by alpha, what BlendPremultiplied expects
+    inline void Premultiply(const TGAColor* src, TGAColor* dst, size_t count)
+    {
+        size_t simdCount = 0;
+#if TR_SSE2
+        simdCount = count - count % 4;
+        const auto zero = _mm_setzero_si128();
+        const auto alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0); // keeps alpha itself
+        const auto premultiply = [&](__m128i colors)
+        {
+            const auto scaled = Div255(_mm_mullo_epi16(colors, BroadcastAlpha(colors)));
+            return _mm_or_si128(_mm_andnot_si128(alphaLanes, scaled), _mm_and_si128(alphaLanes, colors));
+        };
+        for (size_t i = 0; i < simdCount; i += 4)
+        {
+            const auto colors = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const auto low = premultiply(_mm_unpacklo_epi8(colors, zero));
+            const auto high = premultiply(_mm_unpackhi_epi8(colors, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(low, high));
+        }
+#endif
+        for (size_t i = simdCount; i < count; i++)
+        {
+            const auto c = src[i];
+            dst[i] = TGAColor(static_cast<unsigned char>(Div255(c.r * c.a)), static_cast<unsigned char>(Div255(c.g * c.a)),
+                static_cast<unsigned char>(Div255(c.b * c.a)), c.a);
+        }
+    }
+
+    // src over dst with premultiplied colors: dst = src + dst * (255 - src alpha) / 255, alpha included
+    inline void BlendPremultiplied(const TGAColor* src, TGAColor* dst, size_t count)
+    {
+        size_t simdCount = 0;
+#if TR_SSE2
+        simdCount = count - count % 4;
+        const auto zero = _mm_setzero_si128();
+        const auto full = _mm_set1_epi16(255);
+        const auto under = [&](__m128i source, __m128i destination)
+        {
+            return Div255(_mm_mullo_epi16(destination, _mm_sub_epi16(full, BroadcastAlpha(source))));
+        };
+        for (size_t i = 0; i < simdCount; i += 4)
+        {
+            const auto source = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const auto destination = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            const auto low = under(_mm_unpacklo_epi8(source, zero), _mm_unpacklo_epi8(destination, zero));
+            const auto high = under(_mm_unpackhi_epi8(source, zero), _mm_unpackhi_epi8(destination, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_adds_epu8(source, _mm_packus_epi16(low, high)));
+        }
+#endif
+        for (size_t i = simdCount; i < count; i++)
+        {
+            const auto s = src[i];
+            auto& d = dst[i];
+            const auto inverse = 255u - s.a;
+            for (auto k = 0; k < 4; k++)
+            {
+                const auto sum = s.raw[k] + Div255(d.raw[k] * inverse);
+                d.raw[k] = static_cast<unsigned char>(sum > 255 ? 255 : sum);
+            }
+        }
+    }
+}
+
+// The fragments of one triangle, lit all at once when it is done instead of one multiply per channel and fragment.
+// A triangle covers every pixel at most once, so holding its writes back until then changes nothing.
+class ShadedFragments
+{
+public:
+    void Add(unsigned char* target, const TGAColor& color, double intensity)
+    {
+        _targets.push_back(target);
+        _colors.push_back(color);
+        _intensities.push_back(intensity);
+    }
+
+    // writes the first bytespp bytes of every lit color, b g r for an RGB image
+    void Flush(int bytespp)
+    {
+        ColorOps::ScaleIntensity(_colors.data(), _intensities.data(), _colors.data(), _colors.size());
+        for (size_t i = 0; i < _colors.size(); i++)
+            std::memcpy(_targets[i], _colors[i].raw, bytespp);
+        _targets.clear();
+        _colors.clear();
+        _intensities.clear();
+    }
+
+private:
+    std::vector<unsigned char*> _targets;
+    std::vector<TGAColor> _colors;
+    std::vector<double> _intensities;
+};
+
+#endif
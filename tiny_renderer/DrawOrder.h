@@ -0,0 +1,62 @@
+#ifndef DrawOrder_h_include
+#define DrawOrder_h_include
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+enum class DrawOrder
+{
+    Submission,     // as the triangles were added
+    FrontToBack     // coarse sort on the quantized depth, nearest first so the depth test rejects more fragments
+};
+
+enum class DepthPass
+{
+    Combined,       // depth test, then depth and color written together
+    DepthOnly,      // pre-pass, only the depth buffer is written
+    EqualShading    // after a pre-pass, only the fragments with exactly the stored depth are shaded
+};
+
+// Front to back order from one depth per triangle, larger z being closer like in all our z buffers.
+// The depths are quantized to 16 bits and sorted with a two pass LSD radix sort, a coarse order is all we need.
+inline void SortFrontToBack(const std::vector<double>& depths, std::vector<uint32_t>& order)
+{
+    const auto count = depths.size();
+    order.resize(count);
+    std::iota(order.begin(), order.end(), 0u);
+    if (count < 2)
+        return;
+
+    const auto minMax = std::minmax_element(depths.begin(), depths.end());
+    const auto range = *minMax.second - *minMax.first;
+    if (range <= 0.)
+        return;
+
+    // the nearest triangle gets key 0
+    const auto scale = 65535. / range;
+    auto keys = std::vector<uint16_t>(count);
+    for (size_t i = 0; i < count; i++)
+        keys[i] = static_cast<uint16_t>((*minMax.second - depths[i]) * scale);
+
+    auto scratch = std::vector<uint32_t>(count);
+    for (auto shift = 0; shift < 16; shift += 8)
+    {
+        size_t offsets[256] = {};
+        for (const auto index : order)
+            offsets[(keys[index] >> shift) & 0xff]++;
+        auto sum = size_t(0);
+        for (auto& offset : offsets)
+        {
+            const auto bucket = offset;
+            offset = sum;
+            sum += bucket;
+        }
+        for (const auto index : order)
+            scratch[offsets[(keys[index] >> shift) & 0xff]++] = index;
+        order.swap(scratch);
+    }
+}
+
+#endif
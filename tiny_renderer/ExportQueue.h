@@ -0,0 +1,198 @@
+#ifndef ExportQueue_h_include
+#define ExportQueue_h_include
+
+#include "tgaimage.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes and writes finished images on background threads so the render loop doesn't wait on the encoder and
+// the disk. Submit takes the image by move and returns at once, unless maxPending images are already queued or
+// being written: then it waits for one to be done, which bounds the memory held whatever the disk speed.
+// Every export reports through its future and, when given, a callback run on the writing thread. An exception
+// from the write or the callback ends up in the future instead of the writing thread, which goes on with the queue.
+class ExportQueue
+{
+public:
+    enum class Format
+    {
+        Tga,
+        TgaRle,
+        Qoi
+    };
+    using Callback = std::function<void(const std::string& path, bool written)>;
+
+    explicit ExportQueue(int threads = 1, size_t maxPending = 4)
+        : _maxPending(std::max<size_t>(maxPending, 1))
+    {
+        try
+        {
+            for (auto t = 0; t < std::max(threads, 1); t++)
+                _threads.emplace_back([this]() { run(); });
+        }
+        catch (...)
+        {
+            // the threads already running are stopped and joined, the queue is never constructed
+            stop();
+            throw;
+        }
+    }
+
+    ExportQueue(const ExportQueue&) = delete;
+    ExportQueue& operator=(const ExportQueue&) = delete;
+
+    // the exports already submitted are all written first
+    ~ExportQueue()
+    {
+        stop();
+    }
+
+    // path is the whole file name, the format doesn't add an extension
+    std::future<bool> Submit(TGAImage&& image, std::string path, Format format = Format::TgaRle, Callback done = nullptr)
+    {
+        auto job = Job{ std::move(image), std::move(path), format, std::move(done), std::promise<bool>() };
+        auto written = job.written.get_future();
+        {
+            TR_TRACE_SCOPE("ExportQueue::Submit wait");
+            auto lock = std::unique_lock<std::mutex>(_mutex);
+            if (_jobs.size() + _writing >= _maxPending)
+            {
+                const auto start = std::chrono::steady_clock::now();
+                _space.wait(lock, [this]() { return _jobs.size() + _writing < _maxPending; });
+                _waitedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            _jobs.push_back(std::move(job));
+        }
+        _queued.notify_one();
+        return written;
+    }
+
+    // waits until every export submitted so far is written
+    void Flush()
+    {
+        auto lock = std::unique_lock<std::mutex>(_mutex);
+        _space.wait(lock, [this]() { return _jobs.empty() && _writing == 0; });
+    }
+
+    size_t Pending() const
+    {
+        auto lock = std::unique_lock<std::mutex>(_mutex);
+        return _jobs.size() + _writing;
+    }
+
+    // how long Submit was held back by a full queue, the part of the writing the render loop didn't hide
+    double WaitedSeconds() const
+    {
+        auto lock = std::unique_lock<std::mutex>(_mutex);
+        return _waitedSeconds;
+    }
+
+private:
+    struct Job
+    {
+        TGAImage image;
+        std::string path;
+        Format format;
+        Callback done;
+        std::promise<bool> written;
+    };
+
+    // one encoding thread per writer, the queue's threads are the parallelism
+    static bool write(TGAImage& image, const std::string& path, Format format)
+    {
+        TR_TRACE_SCOPE("ExportQueue::write");
+        switch (format)
+        {
+        case Format::Tga:
+            return image.write_tga_file(path.c_str(), false);
+        case Format::Qoi:
+            return image.write_qoi_file(path.c_str());
+        default:
+            return image.write_tga_file(path.c_str(), true, 1);
+        }
+    }
+
+    void stop()
+    {
+        {
+            auto lock = std::unique_lock<std::mutex>(_mutex);
+            _stopping = true;
+        }
+        _queued.notify_all();
+        for (auto& thread : _threads)
+            thread.join();
+    }
+
+    void run()
+    {
+        for (;;)
+        {
+            auto lock = std::unique_lock<std::mutex>(_mutex);
+            _queued.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+            if (_jobs.empty())
+                return;
+            auto job = std::move(_jobs.front());
+            _jobs.pop_front();
+            _writing++;
+            lock.unlock();
+
+            // a write that throws (out of memory, an encoding thread that can't start) is reported to the callback
+            // as not written, the first exception goes to the future
+            auto failure = std::exception_ptr();
+            auto written = false;
+            try
+            {
+                written = write(job.image, job.path, job.format);
+            }
+            catch (...)
+            {
+                failure = std::current_exception();
+            }
+            // the pixels go back (to the buffer pool when there is one) before anyone is told
+            job.image = TGAImage();
+            if (job.done)
+            {
+                try
+                {
+                    job.done(job.path, written);
+                }
+                catch (...)
+                {
+                    if (!failure)
+                        failure = std::current_exception();
+                }
+            }
+            if (failure)
+                job.written.set_exception(failure);
+            else
+                job.written.set_value(written);
+
+            lock.lock();
+            _writing--;
+            lock.unlock();
+            _space.notify_all();
+        }
+    }
+
+    const size_t _maxPending;
+    mutable std::mutex _mutex;
+    std::condition_variable _queued;    // a job was pushed, or the queue is stopping
+    std::condition_variable _space;     // a job is done
+    std::deque<Job> _jobs;
+    size_t _writing = 0;
+    bool _stopping = false;
+    double _waitedSeconds = 0.;
+    std::vector<std::thread> _threads;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define ImageRenderer2D_h_include
 
 #include "tgaimage.h"
+#include "Rasterizer.h"
 #include <Entities.h>
 
 #include <string>
@@ -12,7 +13,7 @@ class ImageRenderer2D
 {
 public:
     ImageRenderer2D(const uint32_t width, const uint32_t height)
-        :m_image(TGAImage(width, height, TGAImage::RGB))
+        :m_image(width, height, TGAImage::RGB)
         ,m_width(width)
         ,m_height(height)
     {
@@ -83,9 +84,14 @@ public:
         _drawTriangle(p1, p3, p4, color);
     }
 
+    void SetRasterMode(RasterMode mode)
+    {
+        m_rasterMode = mode;
+    }
+
     void ExportImage(std::string path)
     {
-        m_image.flip_vertically(); // I want to have the origin at the left bottom corner of the image
+        m_image.set_bottom_up(true); // I want to have the origin at the left bottom corner of the image
         m_image.write_tga_file(path.append(".tga").c_str());
     }
 
@@ -100,9 +106,9 @@ private:
     {
         const auto minMaxX = std::minmax({ p1.X(), p2.X(), p3.X() });
         const auto minMaxY = std::minmax({ p1.Y(), p2.Y(), p3.Y() });
-        const auto minX = minMaxX.first;
+        const auto minX = std::max(0., minMaxX.first);
         const auto maxX = std::min(m_width - 1., minMaxX.second);
-        const auto minY = minMaxY.first;
+        const auto minY = std::max(0., minMaxY.first);
         const auto maxY = std::min(m_height - 1., minMaxY.second);
         return { minX, maxX, minY, maxY };
     }
@@ -118,6 +124,17 @@ private:
 
     void _drawTriangle(const Vec2f& p1, const Vec2f& p2, const Vec2f& p3, const TGAColor& color)
     {
+        // the fill rule keeps the shared diagonal of DrawRectangle from being drawn twice
+        if (m_rasterMode == RasterMode::FixedPoint)
+        {
+            RasterizeFixedPoint({ p1.X(), p1.Y(), 0. }, { p2.X(), p2.Y(), 0. }, { p3.X(), p3.Y(), 0. }, m_width, m_height,
+                [&](int x, int y, double, double, double)
+                {
+                    m_image.set(x, y, color);
+                });
+            return;
+        }
+
         const auto& bb = findBB(p1, p2, p3);
 
         for (auto x = bb.minX; x <= bb.maxX; x++)
@@ -135,7 +152,7 @@ private:
     TGAImage m_image;
     mutable uint32_t m_width;
     mutable uint32_t m_height;
-
+    RasterMode m_rasterMode = RasterMode::FloatingPoint;
 };
 
 #endif
\ No newline at end of file
@@ -2,8 +2,18 @@
 #define ImageRenderer3D_h_include
 
 #include "tgaimage.h"
+#include "model.h"
+#include "Camera.h"
+#include "Clipper.h"
+#include "Rasterizer.h"
+#include "Shading.h"
+#include "Instancing.h"
+#include "RasterStats.h"
+#include "ColorOps.h"
+#include "ExportQueue.h"
 #include <Entities.h>
 
+#include <limits>
 #include <string>
 
 using namespace MathLib;
@@ -12,11 +22,13 @@ class ImageRenderer3D
 {
 public:
     ImageRenderer3D(const uint32_t width, const uint32_t height)
-        :m_image(TGAImage(width, height, TGAImage::RGB))
+        :m_image(width, height, TGAImage::RGB)
         , m_width(width)
         , m_height(height)
-        , m_zBuffer(m_width * m_height, 0)
+        , m_bandHeight(height)
+        , m_zBuffer(m_width * m_height, std::numeric_limits<double>::lowest())
     {
+        m_image.set_bottom_up(true);
     }
 
     ImageRenderer3D() = delete;
@@ -28,13 +40,203 @@ public:
         const auto& p1 = triangle.m_data[0];
         const auto& p2 = triangle.m_data[1];
         const auto& p3 = triangle.m_data[2];
+        m_stats.submitted++;
         _drawTriangle(p1, p2, p3, color);
     }
 
-    void ExportImage(std::string path)
+    // all instances are transformed in one batch, then drawn with their own color
+    void DrawInstances(const InstanceBatch<TGAColor>& batch)
     {
-        m_image.flip_vertically(); // I want to have the origin at the left bottom corner of the image
-        m_image.write_tga_file(path.append(".tga").c_str());
+        TR_TRACE_SCOPE("ImageRenderer3D::DrawInstances");
+        TransformInstances(batch, m_instanceVertices, m_instanceGeometry);
+        const auto vertexCount = batch.TrianglesPerInstance() * 3;
+        m_stats.submitted += batch.TrianglesPerInstance() * batch.InstanceCount();
+        for (size_t instance = 0; instance < batch.InstanceCount(); instance++)
+        {
+            const auto first = instance * vertexCount;
+            for (size_t v = 0; v < vertexCount; v += 3)
+                _drawTriangle(m_instanceVertices[first + v], m_instanceVertices[first + v + 1], m_instanceVertices[first + v + 2], batch.colors[instance]);
+        }
+    }
+
+    // the african_head pipeline for any model and camera: clipping, perspective correct texturing and lighting,
+    // returns how many triangles were rasterized once culled and clipped
+    size_t DrawModel(const Model& model, const Camera& camera)
+    {
+        TR_TRACE_SCOPE("ImageRenderer3D::DrawModel");
+        const auto viewProjection = camera.ViewProjection();
+        const auto viewport = Viewport(m_width, m_height);
+        const auto cameraDirection = camera.Direction();
+
+        // like african_head, the near/far planes leave room for models a bit larger than [-1, 1]
+        auto clipVolume = Clipper::Volume();
+        clipVolume.minZ = -2.;
+        clipVolume.maxZ = 2.;
+        const auto clipper = Clipper(clipVolume);
+        auto polygon = Clipper::Polygon();
+
+        auto rasterized = size_t(0);
+        for (auto i = 0; i < model.nfaces(); i++)
+        {
+            const auto face = model.face(i);
+            if (face.size() < 3)
+                continue;
+            m_stats.submitted++;
+
+            // the face normals are precomputed by the model, no cross product per frame
+            const auto& faceNormal = model.faceNormal(i);
+            if (faceNormal.Dot(cameraDirection) <= 0)
+            {
+                m_stats.culled++;
+                continue;
+            }
+
+            ClipVertex clipCoords[3];
+            for (int j = 0; j < 3; j++)
+            {
+                clipCoords[j].position = transform(viewProjection, model.vert(face[j]));
+                const auto uv = model.uv(i, j);
+                clipCoords[j].varyings[0] = uv.X();
+                clipCoords[j].varyings[1] = uv.Y();
+                const auto& normal = model.normal(i, j);
+                clipCoords[j].varyings[2] = normal.X();
+                clipCoords[j].varyings[3] = normal.Y();
+                clipCoords[j].varyings[4] = normal.Z();
+            }
+
+            const auto vertexCount = clipper.ClipTriangle(clipCoords[0], clipCoords[1], clipCoords[2], polygon);
+            if (vertexCount == 0)
+            {
+                m_stats.clipped++;
+                continue;
+            }
+
+            // perspective divide and viewport only for what survived the clipping
+            Vec3f screenCoords[Clipper::MaxPolygonVertices];
+            auto minY = std::numeric_limits<double>::max();
+            auto maxY = std::numeric_limits<double>::lowest();
+            for (auto j = 0; j < vertexCount; j++)
+            {
+                const auto& p = polygon[j].position;
+                const auto ndc = transform(viewport, Vec3f{ p[0] / p[3], p[1] / p[3], p[2] / p[3] });
+                screenCoords[j] = Vec3f{ std::round(ndc[0]), std::round(ndc[1]), std::round(ndc[2]) };
+                minY = std::min(minY, screenCoords[j].Y());
+                maxY = std::max(maxY, screenCoords[j].Y());
+            }
+            if (m_bandHeight < m_height && !inBand(minY, maxY))
+            {
+                m_stats.outsideBand++;
+                continue;
+            }
+
+            // the clipped polygon is convex, draw it as a fan
+            for (auto j = 1; j + 1 < vertexCount; j++)
+            {
+                auto t = ShadedTriangle();
+                for (auto vertexIdx = 0; vertexIdx < 3; vertexIdx++)
+                {
+                    const auto polygonIdx = vertexIdx == 0 ? 0 : j + vertexIdx - 1;
+                    const auto& v = polygon[polygonIdx];
+                    t.p[vertexIdx] = screenCoords[polygonIdx];
+                    t.uv[vertexIdx] = Vec2f{ v.varyings[0], v.varyings[1] };
+                    t.w[vertexIdx] = v.position[3];
+                    t.normals[vertexIdx] = Vec3f{ v.varyings[2], v.varyings[3], v.varyings[4] };
+                }
+                t.intensity = Lambert(faceNormal, m_lightDirection);
+                _drawShadedTriangle(t, model.texture());
+                rasterized++;
+            }
+        }
+        return rasterized;
+    }
+
+    // back to a black image and an empty depth buffer, resized if needed, so one renderer can serve many images
+    void Clear(const uint32_t width, const uint32_t height)
+    {
+        ClearBand(width, height, 0, height);
+    }
+
+    // Only the rows [y, y + rows) of a width x height image are drawn from here on: the viewport is still the one
+    // of the whole image but the image and the depth buffer only hold the band. An image too big for memory is
+    // drawn band after band from y = 0 up, each band streamed to a TGAWriter with ExportBand.
+    void ClearBand(const uint32_t width, const uint32_t height, const uint32_t y, const uint32_t rows)
+    {
+        const auto bandHeight = std::min(rows, height - std::min(y, height));
+        if (static_cast<int>(width) != m_image.get_width() || static_cast<int>(bandHeight) != m_image.get_height())
+            m_image = TGAImage(width, bandHeight, TGAImage::RGB);
+        else
+            m_image.clear();
+        m_image.set_bottom_up(true); // I want to have the origin at the left bottom corner of the image
+        m_width = width;
+        m_height = height;
+        m_bandY = y;
+        m_bandHeight = bandHeight;
+        m_zBuffer.assign(static_cast<size_t>(m_width) * m_bandHeight, std::numeric_limits<double>::lowest());
+        m_stats = RasterStats();
+        if (m_overdraw)
+            m_heatmap.Reset(m_width, m_bandHeight);
+    }
+
+    // what was drawn since the last Clear
+    const RasterStats& GetRasterStats() const
+    {
+        return m_stats;
+    }
+
+    // counts the fragments written to every pixel from the next Clear on, at the cost of one more store per fragment
+    void EnableOverdrawHeatmap(bool enable)
+    {
+        m_overdraw = enable;
+        if (enable)
+            m_heatmap.Reset(m_width, m_bandHeight);
+    }
+
+    bool ExportOverdrawHeatmap(std::string path) const
+    {
+        return m_overdraw && m_heatmap.Write(path.append(".tga").c_str());
+    }
+
+    void SetRasterMode(RasterMode mode)
+    {
+        m_rasterMode = mode;
+    }
+
+    void SetShadingMode(ShadingMode mode)
+    {
+        m_shadingMode = mode;
+    }
+
+    // points towards the light
+    void SetLightDirection(const Vec3f& direction)
+    {
+        m_lightDirection = direction;
+    }
+
+    bool ExportImage(std::string path)
+    {
+        return m_image.write_tga_file(path.append(".tga").c_str());
+    }
+
+    // hands the image over to the queue and draws on in a fresh one of the same size, the write overlaps the next
+    // frames and reports through the future
+    std::future<bool> ExportImage(ExportQueue& queue, std::string path)
+    {
+        auto image = TGAImage(m_image.get_width(), m_image.get_height(), TGAImage::RGB);
+        image.set_bottom_up(true);
+        std::swap(m_image, image);
+        return queue.Submit(std::move(image), path.append(".tga"));
+    }
+
+    // the image drawn since the last Clear, bottom up
+    const TGAImage& GetImage() const
+    {
+        return m_image;
+    }
+
+    // the band drawn since ClearBand, to a writer opened bottom up for the whole image
+    bool ExportBand(TGAWriter& writer) const
+    {
+        return writer.write_band(m_image);
     }
 
 private:
@@ -44,29 +246,185 @@ private:
     };
     using BB = BoundingBox;
 
+    // a clipped triangle after the perspective divide, with everything its fragments need
+    struct ShadedTriangle
+    {
+        Vec3f p[3];
+        Vec2f uv[3];
+        double w[3];
+        Vec3f normals[3];
+        double intensity;
+    };
+
+    static Vec4f transform(const Transform4& m, const Vec3f& v)
+    {
+        return Vec4f{ m[0] * v.X() + m[1] * v.Y() + m[2] * v.Z() + m[3],
+                      m[4] * v.X() + m[5] * v.Y() + m[6] * v.Z() + m[7],
+                      m[8] * v.X() + m[9] * v.Y() + m[10] * v.Z() + m[11],
+                      m[12] * v.X() + m[13] * v.Y() + m[14] * v.Z() + m[15] };
+    }
+
     BB findBB(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3)
     {
         const auto minMaxX = std::minmax({ p1.X(), p2.X(), p3.X() });
         const auto minMaxY = std::minmax({ p1.Y(), p2.Y(), p3.Y() });
-        const auto minX = minMaxX.first;
+        const auto minX = std::max(0., minMaxX.first);
         const auto maxX = std::min(m_width - 1., minMaxX.second);
-        const auto minY = minMaxY.first;
-        const auto maxY = std::min(m_height - 1., minMaxY.second);
+        const auto minY = std::max(static_cast<double>(m_bandY), minMaxY.first);
+        const auto maxY = std::min(m_bandY + m_bandHeight - 1., minMaxY.second);
         return { minX, maxX, minY, maxY };
     }
 
+    PixelRect band() const
+    {
+        return { 0, static_cast<int>(m_bandY), static_cast<int>(m_width) - 1, static_cast<int>(m_bandY + m_bandHeight) - 1 };
+    }
+
+    // rows [minY, maxY] of the image reach the band
+    bool inBand(double minY, double maxY) const
+    {
+        return maxY >= m_bandY && minY <= m_bandY + m_bandHeight - 1.;
+    }
+
+    // where the pixel is in the band's image and depth buffer
+    size_t bandIndex(int x, int y) const
+    {
+        return x + static_cast<size_t>(y - m_bandY) * m_width;
+    }
+
+    // the floating point loops step through the box from its minimum corner
+    static uint64_t boxPixels(const BB& bb)
+    {
+        if (bb.maxX < bb.minX || bb.maxY < bb.minY)
+            return 0;
+        return static_cast<uint64_t>(std::floor(bb.maxX - bb.minX) + 1) * static_cast<uint64_t>(std::floor(bb.maxY - bb.minY) + 1);
+    }
+
+    void fragmentWritten(int x, int y)
+    {
+        m_stats.fragmentsWritten++;
+        if (m_overdraw)
+            m_heatmap.Add(x, y - m_bandY);
+    }
+
     Vec3f barycentric(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3, const Vec3f& P)
     {
         const auto u = Vec3f{ {p2.X() - p1.X(), p3.X() - p1.X(), p1.X() - P.X()} }.
             Cross(Vec3f{ p2.Y() - p1.Y(),p3.Y() - p1.Y(), p1.Y() - P.Y() });
         if (std::abs(u.Z()) < 1)
             return { -1., 1., 1. };
-        return Vec3f{ {1. - (u.X() + u.Y()) / u.Z(), u.Y() / u.Z(), u.X() / u.Z()} };
+        return Vec3f{ {1. - (u.X() + u.Y()) / u.Z(), u.X() / u.Z(), u.Y() / u.Z()} };
+    }
+
+    void _drawShadedTriangle(const ShadedTriangle& t, const Texture& texture)
+    {
+        const auto& p1 = t.p[0];
+        const auto& p2 = t.p[1];
+        const auto& p3 = t.p[2];
+        const auto& uv = t.uv;
+        const auto& normals = t.normals;
+
+        const auto perspective = PerspectiveCorrection(p1, p2, p3, t.w[0], t.w[1], t.w[2]);
+        const auto interpolateUV = [&](double b1, double b2, double b3)
+        {
+            perspective.Correct(b1, b2, b3);
+            return Vec2f{ uv[0].X() * b1 + uv[1].X() * b2 + uv[2].X() * b3, uv[0].Y() * b1 + uv[1].Y() * b2 + uv[2].Y() * b3 };
+        };
+
+        double vertexIntensity[3] = { t.intensity, t.intensity, t.intensity };
+        if (m_shadingMode == ShadingMode::Gouraud)
+        {
+            for (auto i = 0; i < 3; i++)
+                vertexIntensity[i] = Lambert(normals[i], m_lightDirection);
+        }
+        const auto shade = [&](double b1, double b2, double b3)
+        {
+            if (m_shadingMode == ShadingMode::Flat)
+                return t.intensity;
+            perspective.Correct(b1, b2, b3);
+            if (m_shadingMode == ShadingMode::Gouraud)
+                return vertexIntensity[0] * b1 + vertexIntensity[1] * b2 + vertexIntensity[2] * b3;
+            auto n = normals[0] * b1 + normals[1] * b2 + normals[2] * b3;
+            n.Normalize();
+            return Lambert(n, m_lightDirection);
+        };
+
+        const auto fragment = [&](int x, int y, double b1, double b2, double b3)
+        {
+            m_stats.coveredPixels++;
+            const auto z = p1.Z() * b1 + p2.Z() * b2 + p3.Z() * b3;
+            auto& depth = m_zBuffer[bandIndex(x, y)];
+            if (z < depth)
+                return;
+            depth = z;
+            m_stats.depthPasses++;
+
+            auto c = TGAColor(255, 255, 255, 255);
+            if (!texture.Empty())
+            {
+                // the uv one pixel to the right and one pixel up give the derivatives for the mip selection
+                const auto& dx = perspective.dBdx;
+                const auto& dy = perspective.dBdy;
+                const auto t = interpolateUV(b1, b2, b3);
+                const auto tx = interpolateUV(b1 + dx[0], b2 + dx[1], b3 + dx[2]);
+                const auto ty = interpolateUV(b1 + dy[0], b2 + dy[1], b3 + dy[2]);
+                const auto lod = Texture::Lod(tx.X() - t.X(), tx.Y() - t.Y(), ty.X() - t.X(), ty.Y() - t.Y());
+                c = texture.Sample(t.X(), t.Y(), lod);
+            }
+            // lit with all the other fragments of the triangle once it is rasterized
+            m_shaded.Add(m_image.row(y - m_bandY) + x * TGAImage::RGB, c, shade(b1, b2, b3));
+            fragmentWritten(x, y);
+        };
+
+        m_stats.rasterized++;
+        if (m_rasterMode == RasterMode::FixedPoint)
+        {
+            m_stats.boxPixels += RasterizeFixedPoint(p1, p2, p3, band(), fragment);
+        }
+        else if (!IsDegenerate(p1, p2, p3))
+        {
+            const auto& bb = findBB(p1, p2, p3);
+            m_stats.boxPixels += boxPixels(bb);
+            for (auto x = bb.minX; x <= bb.maxX; x++)
+            {
+                for (auto y = bb.minY; y <= bb.maxY; y++)
+                {
+                    auto bc = barycentric(p1, p2, p3, { x, y });
+                    if (bc.X() < 0 || bc.Y() < 0 || bc.Z() < 0)
+                        continue;
+                    fragment(static_cast<int>(x), static_cast<int>(y), bc.X(), bc.Y(), bc.Z());
+                }
+            }
+        }
+        m_shaded.Flush(TGAImage::RGB);
     }
 
     void _drawTriangle(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3, const TGAColor& color)
     {
+        m_stats.rasterized++;
+        if (m_rasterMode == RasterMode::FixedPoint)
+        {
+            m_stats.boxPixels += RasterizeFixedPoint(p1, p2, p3, band(), [&](int x, int y, double b1, double b2, double b3)
+                {
+                    m_stats.coveredPixels++;
+                    const auto z = p1.Z() * b1 + p2.Z() * b2 + p3.Z() * b3;
+                    const auto screenPixel = bandIndex(x, y);
+                    if (m_zBuffer[screenPixel] < z)
+                    {
+                        m_stats.depthPasses++;
+                        m_image.row_span<RGB8>(y - m_bandY)[x] = RGB8{ color.b, color.g, color.r };
+                        m_zBuffer[screenPixel] = z;
+                        fragmentWritten(x, y);
+                    }
+                });
+            return;
+        }
+
+        if (IsDegenerate(p1, p2, p3))
+            return;
+
         const auto& bb = findBB(p1, p2, p3);
+        m_stats.boxPixels += boxPixels(bb);
 
         for (auto x = bb.minX; x <= bb.maxX; x++)
         {
@@ -75,12 +433,15 @@ private:
                 auto bc = barycentric(p1, p2, p3, { x, y });
                 if (bc.X() < 0 || bc.Y() < 0 || bc.Z() < 0)
                     continue;
+                m_stats.coveredPixels++;
                 auto z = p1.Z() * bc.X() + p2.Z() * bc.Y() + p3.Z() * bc.Z();
-                const auto screenPixel = static_cast<int>(x + y * m_width);
+                const auto screenPixel = bandIndex(static_cast<int>(x), static_cast<int>(y));
                 if (m_zBuffer[screenPixel] < z)
                 {
-                    m_image.set(x, y, color);
+                    m_stats.depthPasses++;
+                    m_image.row_span<RGB8>(static_cast<int>(y) - m_bandY)[static_cast<int>(x)] = RGB8{ color.b, color.g, color.r };
                     m_zBuffer[screenPixel] = z;
+                    fragmentWritten(static_cast<int>(x), static_cast<int>(y));
                 }
             }
         }
@@ -89,7 +450,18 @@ private:
     TGAImage m_image;
     mutable uint32_t m_width;
     mutable uint32_t m_height;
+    uint32_t m_bandY = 0;           // first row of the image held in m_image and m_zBuffer
+    uint32_t m_bandHeight;
     std::vector<double> m_zBuffer;
+    RasterMode m_rasterMode = RasterMode::FloatingPoint;
+    ShadingMode m_shadingMode = ShadingMode::Gouraud;
+    Vec3f m_lightDirection = Vec3f{ 0., 0., 1. };
+    TransformedVertices m_instanceVertices;
+    TransformedVertices m_instanceGeometry;
+    ShadedFragments m_shaded;
+    RasterStats m_stats;
+    bool m_overdraw = false;
+    OverdrawHeatmap m_heatmap;
 };
 
 #endif
\ No newline at end of file
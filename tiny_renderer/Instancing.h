@@ -0,0 +1,177 @@
+#ifndef Instancing_h_include
+#define Instancing_h_include
+
+#include "Simd.h"
+#include "Trace.h"
+
+#include <VecN.h>
+
+#include <array>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+using namespace MathLib;
+
+// 3x4 row-major affine transform, the last row of the 4x4 matrix is always 0 0 0 1 so it is not stored
+struct AffineTransform
+{
+    std::array<double, 12> m;
+
+    static AffineTransform Identity()
+    {
+        return { { 1., 0., 0., 0.,
+                   0., 1., 0., 0.,
+                   0., 0., 1., 0. } };
+    }
+
+    static AffineTransform Translation(const Vec3f& offsets)
+    {
+        auto t = Identity();
+        t.m[3] = offsets.X();
+        t.m[7] = offsets.Y();
+        t.m[11] = offsets.Z();
+        return t;
+    }
+
+    static AffineTransform Scale(const Vec3f& factors)
+    {
+        auto t = Identity();
+        t.m[0] = factors.X();
+        t.m[5] = factors.Y();
+        t.m[10] = factors.Z();
+        return t;
+    }
+
+    static AffineTransform RotationZ(double degrees)
+    {
+        const auto rads = degrees * std::acos(-1) / 180.;
+        auto t = Identity();
+        t.m[0] = std::cos(rads);
+        t.m[1] = -std::sin(rads);
+        t.m[4] = std::sin(rads);
+        t.m[5] = std::cos(rads);
+        return t;
+    }
+
+    // this * rhs, rhs is applied first
+    AffineTransform operator*(const AffineTransform& rhs) const
+    {
+        auto result = AffineTransform();
+        for (auto row = 0; row < 3; row++)
+        {
+            for (auto col = 0; col < 4; col++)
+            {
+                auto sum = col == 3 ? m[row * 4 + 3] : 0.;
+                for (auto k = 0; k < 3; k++)
+                    sum += m[row * 4 + k] * rhs.m[k * 4 + col];
+                result.m[row * 4 + col] = sum;
+            }
+        }
+        return result;
+    }
+};
+
+// One triangle list shared by every instance, each instance only adds its transform and its color.
+template <typename ColorType>
+struct InstanceBatch
+{
+    std::shared_ptr<const std::vector<Vec3f>> geometry; // 3 vertices per triangle
+    std::vector<AffineTransform> transforms;
+    std::vector<ColorType> colors;
+
+    size_t InstanceCount() const
+    {
+        return transforms.size();
+    }
+
+    size_t TrianglesPerInstance() const
+    {
+        return geometry ? geometry->size() / 3 : 0;
+    }
+
+    size_t GeometryBytes() const
+    {
+        return geometry ? geometry->size() * sizeof(Vec3f) : 0;
+    }
+
+    static constexpr size_t BytesPerInstance()
+    {
+        return sizeof(AffineTransform) + sizeof(ColorType);
+    }
+};
+
+// vertices of all instances of a batch, as a structure of arrays, instance after instance
+struct TransformedVertices
+{
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+
+    Vec3f operator[](size_t i) const
+    {
+        return Vec3f{ x[i], y[i], z[i] };
+    }
+};
+
+// Transforms the shared geometry once per instance into out, reusing its storage between frames.
+// The geometry is split into a structure of arrays once, then every transform runs on two vertices per SSE2 register.
+template <typename ColorType>
+void TransformInstances(const InstanceBatch<ColorType>& batch, TransformedVertices& out, TransformedVertices& geometry)
+{
+    TR_TRACE_SCOPE("TransformInstances");
+    const auto vertexCount = batch.geometry ? batch.geometry->size() : 0;
+    const auto total = vertexCount * batch.InstanceCount();
+    out.x.resize(total);
+    out.y.resize(total);
+    out.z.resize(total);
+    geometry.x.resize(vertexCount);
+    geometry.y.resize(vertexCount);
+    geometry.z.resize(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        const auto& v = (*batch.geometry)[i];
+        geometry.x[i] = v.X();
+        geometry.y[i] = v.Y();
+        geometry.z[i] = v.Z();
+    }
+
+    for (size_t instance = 0; instance < batch.InstanceCount(); instance++)
+    {
+        const auto& m = batch.transforms[instance].m;
+        auto* outX = out.x.data() + instance * vertexCount;
+        auto* outY = out.y.data() + instance * vertexCount;
+        auto* outZ = out.z.data() + instance * vertexCount;
+        size_t i = 0;
+#if TR_SSE2
+        __m128d rows[3][4];
+        for (auto row = 0; row < 3; row++)
+            for (auto col = 0; col < 4; col++)
+                rows[row][col] = _mm_set1_pd(m[row * 4 + col]);
+        for (; i + 2 <= vertexCount; i += 2)
+        {
+            const auto x = _mm_loadu_pd(&geometry.x[i]);
+            const auto y = _mm_loadu_pd(&geometry.y[i]);
+            const auto z = _mm_loadu_pd(&geometry.z[i]);
+            double* outputs[3] = { outX, outY, outZ };
+            for (auto row = 0; row < 3; row++)
+            {
+                const auto r = _mm_add_pd(_mm_add_pd(_mm_mul_pd(rows[row][0], x), _mm_mul_pd(rows[row][1], y)),
+                    _mm_add_pd(_mm_mul_pd(rows[row][2], z), rows[row][3]));
+                _mm_storeu_pd(outputs[row] + i, r);
+            }
+        }
+#endif
+        for (; i < vertexCount; i++)
+        {
+            const auto x = geometry.x[i];
+            const auto y = geometry.y[i];
+            const auto z = geometry.z[i];
+            outX[i] = m[0] * x + m[1] * y + m[2] * z + m[3];
+            outY[i] = m[4] * x + m[5] * y + m[6] * z + m[7];
+            outZ[i] = m[8] * x + m[9] * y + m[10] * z + m[11];
+        }
+    }
+}
+
+#endif
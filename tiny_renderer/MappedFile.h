@@ -0,0 +1,99 @@
+#ifndef MappedFile_h_include
+#define MappedFile_h_include
+
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read-only into memory, the pages are only read from disk when touched
+// and are shared with the page cache, nothing is copied.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const char* filename)
+    {
+#ifdef _WIN32
+        const auto file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        {
+            const auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping)
+            {
+                _data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                _size = _data ? static_cast<size_t>(size.QuadPart) : 0;
+                // the view keeps the mapping alive
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+#else
+        const auto fd = open(filename, O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            auto* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                _data = static_cast<const unsigned char*>(data);
+                _size = static_cast<size_t>(info.st_size);
+                // the whole file is read front to back
+                madvise(data, _size, MADV_SEQUENTIAL);
+            }
+        }
+        // the mapping keeps the file alive
+        close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+        if (!_data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+#else
+        munmap(const_cast<unsigned char*>(_data), _size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool IsOpen() const
+    {
+        return _data != nullptr;
+    }
+
+    const unsigned char* Data() const
+    {
+        return _data;
+    }
+
+    size_t Size() const
+    {
+        return _size;
+    }
+
+private:
+    const unsigned char* _data = nullptr;
+    size_t _size = 0;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef Profiler_h_include
+#define Profiler_h_include
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum class Stage
+{
+    Clear,
+    Vertex,     // change collection, instance transforms and draw order sorting
+    Raster,     // both passes over the triangles and instances
+    Convert,    // copy of a finished buffer into the window surface
+    Present,
+    Frame,      // between two presented frames
+    Count
+};
+
+constexpr size_t StageCount = static_cast<size_t>(Stage::Count);
+
+inline const char* StageName(Stage stage)
+{
+    static const char* names[StageCount] = { "clear", "vertex", "raster", "convert", "present", "frame" };
+    return names[static_cast<size_t>(stage)];
+}
+
+struct StageSummary
+{
+    unsigned long long count = 0;
+    double min = 0.;    // all in milliseconds
+    double mean = 0.;
+    double p50 = 0.;
+    double p99 = 0.;
+    double max = 0.;
+};
+
+// Log-linear histogram of nanosecond durations: exact below 16 ns, then 16 buckets per power of two,
+// so a percentile read from it is within 1/16 of the real value whatever the magnitude, in a fixed size.
+// Only the owning thread records, any thread can read: the owner updates with plain relaxed loads and stores,
+// which cost the same as non atomic ones, and a reader sees every value whole.
+class DurationHistogram
+{
+public:
+    static constexpr int SubBucketBits = 4;
+    static constexpr uint64_t SubBuckets = 1 << SubBucketBits;
+    static constexpr size_t BucketCount = (64 - SubBucketBits + 1) * SubBuckets;
+
+    void Record(uint64_t ns)
+    {
+        bump(_buckets[bucketOf(ns)], 1);
+        bump(_count, 1);
+        bump(_sum, ns);
+        if (ns < _min.load(std::memory_order_relaxed))
+            _min.store(ns, std::memory_order_relaxed);
+        if (ns > _max.load(std::memory_order_relaxed))
+            _max.store(ns, std::memory_order_relaxed);
+    }
+
+private:
+    friend class FrameProfiler;
+
+    static size_t bucketOf(uint64_t ns)
+    {
+        if (ns < SubBuckets)
+            return static_cast<size_t>(ns);
+        auto exponent = 0;
+        while ((ns >> exponent) >= 2 * SubBuckets)
+            exponent++;
+        // exponent + SubBucketBits is the position of the highest bit, the sub bucket the bits right below it
+        return static_cast<size_t>((exponent + 1) * SubBuckets + ((ns >> exponent) - SubBuckets));
+    }
+
+    // middle of the range a bucket covers
+    static double bucketValue(size_t bucket)
+    {
+        if (bucket < SubBuckets)
+            return static_cast<double>(bucket);
+        const auto exponent = static_cast<int>(bucket / SubBuckets) - 1;
+        const auto low = static_cast<double>((SubBuckets + bucket % SubBuckets) << exponent);
+        return low + ((uint64_t(1) << exponent) - 1) / 2.;
+    }
+
+    static void bump(std::atomic<uint64_t>& value, uint64_t by)
+    {
+        value.store(value.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, BucketCount> _buckets{};
+    std::atomic<uint64_t> _count{ 0 };
+    std::atomic<uint64_t> _sum{ 0 };
+    std::atomic<uint64_t> _min{ std::numeric_limits<uint64_t>::max() };
+    std::atomic<uint64_t> _max{ 0 };
+};
+
+// the histograms of every stage for one thread, it is the only one recording into them
+struct ThreadProfile
+{
+    std::array<DurationHistogram, StageCount> stages;
+
+    void Record(Stage stage, uint64_t ns)
+    {
+        stages[static_cast<size_t>(stage)].Record(ns);
+    }
+
+    void Record(Stage stage, std::chrono::steady_clock::duration elapsed)
+    {
+        Record(stage, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+};
+
+// Records the time until the end of the scope, a clock read on both ends and a few stores into the thread's histogram.
+class ScopedStageTimer
+{
+public:
+    ScopedStageTimer(ThreadProfile& profile, Stage stage)
+        : _profile(profile), _stage(stage), _start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ScopedStageTimer()
+    {
+        _profile.Record(_stage, std::chrono::steady_clock::now() - _start);
+    }
+
+    ScopedStageTimer(const ScopedStageTimer&) = delete;
+    ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+    ThreadProfile& _profile;
+    Stage _stage;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// Per stage timings of all threads taking part in a frame. Every thread asks once for its own ThreadProfile,
+// that is the only allocation, and records into it without locks from then on. Summaries merge all of them.
+class FrameProfiler
+{
+public:
+    ThreadProfile& RegisterThread()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _threads.push_back(std::make_unique<ThreadProfile>());
+        return *_threads.back();
+    }
+
+    // drops every thread's profile, only while none of them records
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _threads.clear();
+    }
+
+    StageSummary Summarize(Stage stage) const
+    {
+        auto buckets = std::array<uint64_t, DurationHistogram::BucketCount>();
+        auto count = uint64_t(0);
+        auto sum = uint64_t(0);
+        auto min = std::numeric_limits<uint64_t>::max();
+        auto max = uint64_t(0);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (const auto& thread : _threads)
+            {
+                const auto& histogram = thread->stages[static_cast<size_t>(stage)];
+                for (size_t i = 0; i < buckets.size(); i++)
+                    buckets[i] += histogram._buckets[i].load(std::memory_order_relaxed);
+                count += histogram._count.load(std::memory_order_relaxed);
+                sum += histogram._sum.load(std::memory_order_relaxed);
+                min = std::min(min, histogram._min.load(std::memory_order_relaxed));
+                max = std::max(max, histogram._max.load(std::memory_order_relaxed));
+            }
+        }
+
+        auto summary = StageSummary();
+        if (count == 0)
+            return summary;
+        const auto toMs = [min, max](double ns) { return std::min(std::max(ns, double(min)), double(max)) / 1e6; };
+        summary.count = count;
+        summary.min = min / 1e6;
+        summary.max = max / 1e6;
+        summary.mean = sum / 1e6 / count;
+        summary.p50 = toMs(percentile(buckets, count, 0.5));
+        summary.p99 = toMs(percentile(buckets, count, 0.99));
+        return summary;
+    }
+
+    void LogSummary(const char* title) const
+    {
+        spdlog::info("{}", title);
+        for (size_t i = 0; i < StageCount; i++)
+        {
+            const auto stage = static_cast<Stage>(i);
+            const auto summary = Summarize(stage);
+            if (summary.count == 0)
+                continue;
+            spdlog::info("  {:<8} {:>7} samples, min {:.3f} ms, mean {:.3f} ms, p50 {:.3f} ms, p99 {:.3f} ms, max {:.3f} ms",
+                StageName(stage), summary.count, summary.min, summary.mean, summary.p50, summary.p99, summary.max);
+        }
+    }
+
+private:
+    static double percentile(const std::array<uint64_t, DurationHistogram::BucketCount>& buckets, uint64_t count, double fraction)
+    {
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * count)));
+        auto seen = uint64_t(0);
+        for (size_t i = 0; i < buckets.size(); i++)
+        {
+            seen += buckets[i];
+            if (seen >= rank)
+                return DurationHistogram::bucketValue(i);
+        }
+        return DurationHistogram::bucketValue(buckets.size() - 1);
+    }
+
+    mutable std::mutex _mutex;
+    std::vector<std::unique_ptr<ThreadProfile>> _threads;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef RasterStats_h_include
+#define RasterStats_h_include
+
+#include "tgaimage.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What the rasterizers did with the triangles of a frame. Every renderer counts into its own, so every thread does,
+// with plain increments, and whoever owns the frame merges them with +=.
+struct RasterStats
+{
+    unsigned long long submitted = 0;       // triangles handed to a draw call
+    unsigned long long culled = 0;          // back facing, or outside the region being drawn
+    unsigned long long outsideBand = 0;     // drawing in bands, left for the other bands
+    unsigned long long clipped = 0;         // rejected entirely by the clipper
+    unsigned long long rasterized = 0;      // handed to a rasterizer, clipped polygons count one per fan triangle
+    unsigned long long boxPixels = 0;       // pixels tested in the bounding boxes
+    unsigned long long coveredPixels = 0;   // of those, inside their triangle
+    unsigned long long depthPasses = 0;
+    unsigned long long fragmentsWritten = 0;
+
+    RasterStats& operator+=(const RasterStats& other)
+    {
+        submitted += other.submitted;
+        culled += other.culled;
+        outsideBand += other.outsideBand;
+        clipped += other.clipped;
+        rasterized += other.rasterized;
+        boxPixels += other.boxPixels;
+        coveredPixels += other.coveredPixels;
+        depthPasses += other.depthPasses;
+        fragmentsWritten += other.fragmentsWritten;
+        return *this;
+    }
+
+    // share of the bounding box traversal spent on pixels outside the triangles, the thinner the triangles the higher
+    double BoxWaste() const
+    {
+        return boxPixels == 0 ? 0. : 1. - static_cast<double>(coveredPixels) / boxPixels;
+    }
+
+    void Log(const char* title) const
+    {
+        spdlog::info("{}: {} triangles submitted, {} culled, {} clipped, {} rasterized, {} pixels tested, {} covered ({:.1f}% of the box traversal wasted), "
+            "{} depth passes, {} fragments written{}", title, submitted, culled, clipped, rasterized, boxPixels, coveredPixels,
+            100. * BoxWaste(), depthPasses, fragmentsWritten,
+            outsideBand == 0 ? std::string() : fmt::format(", {} band skips", outsideBand));
+    }
+};
+
+// Fragments written per pixel, y up like the renderers' images. Black was never written,
+// blue was written once and the colors go through green and yellow to red at the most overdrawn pixel.
+class OverdrawHeatmap
+{
+public:
+    void Reset(int width, int height)
+    {
+        _width = width;
+        _height = height;
+        _counts.assign(static_cast<size_t>(width) * height, 0);
+    }
+
+    void Add(int x, int y)
+    {
+        _counts[x + static_cast<size_t>(y) * _width]++;
+    }
+
+    uint32_t MaxCount() const
+    {
+        return _counts.empty() ? 0 : *std::max_element(_counts.begin(), _counts.end());
+    }
+
+    bool Write(const char* filename) const
+    {
+        static const TGAColor ramp[] = { TGAColor(0, 0, 255, 255), TGAColor(0, 255, 0, 255), TGAColor(255, 255, 0, 255), TGAColor(255, 0, 0, 255) };
+        constexpr auto steps = sizeof(ramp) / sizeof(ramp[0]) - 1;
+
+        const auto maxCount = MaxCount();
+        auto image = TGAImage(_width, _height, TGAImage::RGB);
+        for (auto y = 0; y < _height; y++)
+        {
+            // the image is written top down, the rows are taken bottom up instead of flipping it
+            const auto row = image.row_span<RGB8>(_height - 1 - y);
+            for (auto x = 0; x < _width; x++)
+            {
+                const auto count = _counts[x + static_cast<size_t>(y) * _width];
+                if (count == 0)
+                    continue;
+                const auto t = maxCount > 1 ? static_cast<double>(count - 1) / (maxCount - 1) * steps : 0.;
+                const auto low = std::min(static_cast<size_t>(t), steps - 1);
+                const auto f = t - low;
+                const auto& a = ramp[low];
+                const auto& b = ramp[low + 1];
+                row[x] = RGB8{ static_cast<unsigned char>(a.b + (b.b - a.b) * f), static_cast<unsigned char>(a.g + (b.g - a.g) * f),
+                    static_cast<unsigned char>(a.r + (b.r - a.r) * f) };
+            }
+        }
+        return image.write_tga_file(filename);
+    }
+
+private:
+    int _width = 0;
+    int _height = 0;
+    std::vector<uint32_t> _counts;
+};
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef Rasterizer_h_include
+#define Rasterizer_h_include
+
+#include <VecN.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+using namespace MathLib;
+
+// Both modes sample pixel (x, y) at the integer coordinates (x, y) of the screen space vertices, so switching
+// between them only changes which pixels exactly on a shared edge are drawn, the image doesn't move.
+enum class RasterMode
+{
+    FloatingPoint,  // barycentric coordinates on doubles for every pixel of the bounding box
+    FixedPoint      // 28.4 integer edge functions with a top-left fill rule
+};
+
+// inclusive pixel rectangle, what the rasterizers can be scissored to
+struct PixelRect
+{
+    int minX, minY, maxX, maxY;
+
+    static PixelRect Screen(int width, int height)
+    {
+        return { 0, 0, width - 1, height - 1 };
+    }
+
+    // every pixel whose sample point can be covered by the triangle, clipped to bounds
+    static PixelRect Bounding(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3, const PixelRect& bounds)
+    {
+        const auto minMaxX = std::minmax({ p1.X(), p2.X(), p3.X() });
+        const auto minMaxY = std::minmax({ p1.Y(), p2.Y(), p3.Y() });
+        return PixelRect{ static_cast<int>(std::max<double>(bounds.minX, std::floor(minMaxX.first))),
+            static_cast<int>(std::max<double>(bounds.minY, std::floor(minMaxY.first))),
+            static_cast<int>(std::min<double>(bounds.maxX, std::ceil(minMaxX.second))),
+            static_cast<int>(std::min<double>(bounds.maxY, std::ceil(minMaxY.second))) };
+    }
+
+    bool Empty() const
+    {
+        return minX > maxX || minY > maxY;
+    }
+
+    long long Area() const
+    {
+        return Empty() ? 0 : static_cast<long long>(maxX - minX + 1) * (maxY - minY + 1);
+    }
+
+    bool Intersects(const PixelRect& other) const
+    {
+        return minX <= other.maxX && other.minX <= maxX && minY <= other.maxY && other.minY <= maxY;
+    }
+
+    PixelRect Union(const PixelRect& other) const
+    {
+        return { std::min(minX, other.minX), std::min(minY, other.minY), std::max(maxX, other.maxX), std::max(maxY, other.maxY) };
+    }
+};
+
+namespace FixedPoint
+{
+    constexpr int SubpixelBits = 4;
+    constexpr int64_t SubpixelScale = 1 << SubpixelBits;
+
+    inline int64_t ToFixed(double value)
+    {
+        return static_cast<int64_t>(std::llround(value * SubpixelScale));
+    }
+
+    struct Point
+    {
+        int64_t x, y;
+    };
+
+    // edge function of a -> b, incrementally evaluated at the pixel sample points
+    struct Edge
+    {
+        int64_t stepX;
+        int64_t stepY;
+        int64_t row;
+        int64_t bias;
+
+        // sign flips the edge so that the inside of the triangle is always positive
+        Edge(const Point& a, const Point& b, int64_t sign, const Point& origin)
+        {
+            const auto dx = (b.x - a.x) * sign;
+            const auto dy = (b.y - a.y) * sign;
+            stepX = -dy * SubpixelScale;
+            stepY = dx * SubpixelScale;
+
+            // top-left rule: sample points exactly on an edge only belong to the triangle if the edge is
+            // a left edge or a horizontal top one, so the two triangles sharing an edge never both draw it
+            const auto topLeft = dy < 0 || (dy == 0 && dx < 0);
+            bias = topLeft ? 0 : -1;
+            row = dx * (origin.y - a.y) - dy * (origin.x - a.x) + bias;
+        }
+    };
+}
+
+// Calls fragment(x, y, b1, b2, b3) for every pixel sample point covered by the triangle inside the scissor rectangle.
+// The setup is done in integers and the coverage loop only does integer adds and compares, the barycentric
+// weights handed to the fragment are only computed for covered pixels. Returns how many pixels were tested.
+template <typename Fragment>
+uint64_t RasterizeFixedPoint(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3, const PixelRect& scissor, Fragment&& fragment)
+{
+    using namespace FixedPoint;
+
+    const Point v1 = { ToFixed(p1.X()), ToFixed(p1.Y()) };
+    const Point v2 = { ToFixed(p2.X()), ToFixed(p2.Y()) };
+    const Point v3 = { ToFixed(p3.X()), ToFixed(p3.Y()) };
+
+    auto area = (v2.x - v1.x) * (v3.y - v1.y) - (v2.y - v1.y) * (v3.x - v1.x);
+    if (area == 0)
+        return 0;
+    const int64_t sign = area < 0 ? -1 : 1;
+    area *= sign;
+
+    // pixel x is sampled at x * 16, the integer coordinate the floating point path samples it at
+    const auto minX = std::max<int64_t>(scissor.minX, (std::min({ v1.x, v2.x, v3.x }) + SubpixelScale - 1) >> SubpixelBits);
+    const auto maxX = std::min<int64_t>(scissor.maxX, std::max({ v1.x, v2.x, v3.x }) >> SubpixelBits);
+    const auto minY = std::max<int64_t>(scissor.minY, (std::min({ v1.y, v2.y, v3.y }) + SubpixelScale - 1) >> SubpixelBits);
+    const auto maxY = std::min<int64_t>(scissor.maxY, std::max({ v1.y, v2.y, v3.y }) >> SubpixelBits);
+    if (minX > maxX || minY > maxY)
+        return 0;
+
+    const Point origin = { minX << SubpixelBits, minY << SubpixelBits };
+    // each edge is the weight of the opposite vertex
+    auto e1 = Edge(v2, v3, sign, origin);
+    auto e2 = Edge(v3, v1, sign, origin);
+    auto e3 = Edge(v1, v2, sign, origin);
+
+    const auto invArea = 1. / static_cast<double>(area);
+    for (auto y = minY; y <= maxY; y++)
+    {
+        auto w1 = e1.row;
+        auto w2 = e2.row;
+        auto w3 = e3.row;
+        for (auto x = minX; x <= maxX; x++)
+        {
+            if ((w1 | w2 | w3) >= 0)
+            {
+                fragment(static_cast<int>(x), static_cast<int>(y),
+                    (w1 - e1.bias) * invArea, (w2 - e2.bias) * invArea, (w3 - e3.bias) * invArea);
+            }
+            w1 += e1.stepX;
+            w2 += e2.stepX;
+            w3 += e3.stepX;
+        }
+        e1.row += e1.stepY;
+        e2.row += e2.stepY;
+        e3.row += e3.stepY;
+    }
+    return static_cast<uint64_t>((maxX - minX + 1) * (maxY - minY + 1));
+}
+
+// the whole [0, width) x [0, height) framebuffer
+template <typename Fragment>
+uint64_t RasterizeFixedPoint(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3, int width, int height, Fragment&& fragment)
+{
+    return RasterizeFixedPoint(p1, p2, p3, PixelRect::Screen(width, height), std::forward<Fragment>(fragment));
+}
+
+// Screen space barycentric weights are affine in x and y, attributes only become affine once divided by w.
+// Corrects the weights handed to a fragment and gives their screen space derivatives for texture lod selection.
+struct PerspectiveCorrection
+{
+    PerspectiveCorrection(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3, double w1, double w2, double w3)
+        :invW{ 1. / w1, 1. / w2, 1. / w3 }
+    {
+        const auto area = (p2.X() - p1.X()) * (p3.Y() - p1.Y()) - (p2.Y() - p1.Y()) * (p3.X() - p1.X());
+        const auto invArea = area != 0. ? 1. / area : 0.;
+        dBdx[0] = (p2.Y() - p3.Y()) * invArea;
+        dBdx[1] = (p3.Y() - p1.Y()) * invArea;
+        dBdx[2] = (p1.Y() - p2.Y()) * invArea;
+        dBdy[0] = (p3.X() - p2.X()) * invArea;
+        dBdy[1] = (p1.X() - p3.X()) * invArea;
+        dBdy[2] = (p2.X() - p1.X()) * invArea;
+    }
+
+    void Correct(double& b1, double& b2, double& b3) const
+    {
+        b1 *= invW[0];
+        b2 *= invW[1];
+        b3 *= invW[2];
+        const auto norm = 1. / (b1 + b2 + b3);
+        b1 *= norm;
+        b2 *= norm;
+        b3 *= norm;
+    }
+
+    double invW[3];
+    double dBdx[3];
+    double dBdy[3];
+};
+
+#endif
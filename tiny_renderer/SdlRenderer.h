@@ -1,5 +1,9 @@
 #include "unidefs.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <thread>
 
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/basic_file_sink.h>
@@ -8,44 +12,35 @@
 #include <SDL.h>
 
 #include "Entities.h"
-#include "../test/TestUtils.h"
+#include "Clipper.h"
+#include "Rasterizer.h"
+#include "DrawOrder.h"
+#include "Instancing.h"
+#include "Profiler.h"
+#include "RasterStats.h"
+#include "tgaimage.h"
+#include "Trace.h"
 
-struct Color
-{
-    union {
-        struct {
-            unsigned char b, g, r, a;
-        };
-        unsigned char raw[4];
-        unsigned int val;
-    };
-    int bytespp;
-
-    Color() : val(0), bytespp(1) {
-    }
-
-    Color(unsigned char R, unsigned char G, unsigned char B, unsigned char A) : b(B), g(G), r(R), a(A), bytespp(4) {
-    }
+// the same packed four bytes as the images and textures use
+using Color = TGAColor;
 
-    Color(int v, int bpp) : val(v), bytespp(bpp) {
-    }
-
-    Color(const Color& c) : val(c.val), bytespp(c.bytespp) {
-    }
-
-    Color(const unsigned char* p, int bpp) : val(0), bytespp(bpp) {
-        for (int i = 0; i < bpp; i++) {
-            raw[i] = p[i];
-        }
-    }
+enum class PresentMode
+{
+    Serial,         // clear, rasterize and present one after the other on the calling thread
+    DoubleBuffered, // a render thread fills one buffer while the calling thread presents the other
+    TripleBuffered  // same with two buffers to render ahead in, the render thread rarely waits on a slow present
+};
 
-    Color& operator =(const Color& c) {
-        if (this != &c) {
-            bytespp = c.bytespp;
-            val = c.val;
-        }
-        return *this;
-    }
+// mean milliseconds per frame of every stage since Render started, the full distributions are in the profiler summary
+struct StageTimings
+{
+    double clear = 0.;
+    double vertex = 0.;     // change collection, instance transforms and sorting
+    double raster = 0.;     // both passes
+    double convert = 0.;    // copy of a finished buffer into the window surface, only when pipelined
+    double present = 0.;    // SDL_UpdateWindowSurface
+    double frame = 0.;      // between two presented frames, what the fps is computed from
+    unsigned long long frames = 0;
 };
 
 class SdlRenderer
@@ -55,7 +50,7 @@ public:
     SdlRenderer() = delete;
 
     SdlRenderer(int width, int height)
-        :_width(width), _height(height), _zBuffer(_width* _height, std::numeric_limits<double>::lowest()), _pixelColors(_width* _height, Color(0, 0, 0, 255))
+        :_width(width), _height(height), _zBuffer(_width* _height, std::numeric_limits<double>::lowest())
     {
         if (SDL_Init(SDL_INIT_VIDEO) < 0) {
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't initialize SDL: %s", SDL_GetError());
@@ -67,73 +62,551 @@ public:
         }
         _surface = SDL_GetWindowSurface(_window);
         _pixels = static_cast<unsigned int*>(_surface->pixels);
+        detectPixelFormat();
+
+        _tilesX = (_width + TileWidth - 1) / TileWidth;
+        _tilesY = (_height + TileHeight - 1) / TileHeight;
+        _tileGenerations.assign(_tilesX * _tilesY, 0);
+        _depthTilesDirty.assign(_tilesX * _tilesY, 0);
+        // whatever the surface holds at first is not known to be cleared
+        _surfaceTilesDirty.assign(_tilesX * _tilesY, 1);
     }
 
+    // the triangle can be moved between frames through the shared pointer, the change is picked up on the next frame
     void AddRectangle(std::shared_ptr<MathLib::Triangle3D> triangle, const Color& color )
     {
         _triangles.push_back({ triangle, color });
+        _triangleStates.push_back(TriangleState());
+    }
+
+    // the geometry is shared, every instance only stores its transform and color
+    size_t AddInstances(const InstanceBatch<Color>& batch)
+    {
+        _instanceBatches.push_back(batch);
+        _transformedInstances.resize(_instanceBatches.size());
+        auto state = InstanceState();
+        state.changed.assign(batch.InstanceCount(), true);
+        _instanceStates.push_back(state);
+        return _instanceBatches.size() - 1;
+    }
+
+    // replaces a batch added before, only the instances whose transform or color differ count as changed
+    void UpdateInstances(size_t index, const InstanceBatch<Color>& batch)
+    {
+        auto& current = _instanceBatches[index];
+        auto& state = _instanceStates[index];
+        const auto sameGeometry = current.geometry == batch.geometry;
+        const auto count = std::max(current.InstanceCount(), batch.InstanceCount());
+        state.changed.assign(batch.InstanceCount(), false);
+        for (size_t i = 0; i < count; i++)
+        {
+            const auto changed = !sameGeometry || i >= current.InstanceCount() || i >= batch.InstanceCount()
+                || current.transforms[i].m != batch.transforms[i].m || current.colors[i].val != batch.colors[i].val;
+            if (!changed)
+                continue;
+            // where it was is dirty now, where it goes once the batch is transformed again
+            if (i < state.bounds.size())
+                _changes.push_back(state.bounds[i]);
+            if (i < batch.InstanceCount())
+                state.changed[i] = true;
+        }
+        current = batch;
+        state.transformed = false;
+    }
+
+    // called with the frame number before every frame is rendered, on the thread that renders it,
+    // this is where the scene can be changed while Render runs
+    void SetFrameCallback(std::function<void(unsigned long long)> callback)
+    {
+        _frameCallback = std::move(callback);
+    }
+
+    // only the screen regions covered by changed geometry, before or after the change, are cleared and drawn again,
+    // the rest of the frame is kept from the previous one
+    void SetIncrementalRendering(bool enabled)
+    {
+        _incremental = enabled;
+    }
+
+    void SetRasterMode(RasterMode mode)
+    {
+        _rasterMode = mode;
+    }
+
+    void SetDrawOrder(DrawOrder order)
+    {
+        _drawOrder = order;
+    }
+
+    // depth of everything first, then shade only the fragments that ended up visible
+    void SetDepthPrePass(bool enabled)
+    {
+        _depthPrePass = enabled;
+    }
+
+    void SetPresentMode(PresentMode mode)
+    {
+        _presentMode = mode;
+    }
+
+    // stops rendering after that many presented frames, 0 renders until the window is closed
+    void SetFrameLimit(unsigned long long frames)
+    {
+        _frameLimit = frames;
+    }
+
+    // the stage summary is logged every that many seconds while rendering and once at the end, 0 only logs it at the end
+    void SetProfileInterval(double seconds)
+    {
+        _profileInterval = seconds;
+    }
+
+    StageTimings GetStageTimings() const
+    {
+        auto timings = StageTimings();
+        timings.clear = _profiler.Summarize(Stage::Clear).mean;
+        timings.vertex = _profiler.Summarize(Stage::Vertex).mean;
+        timings.raster = _profiler.Summarize(Stage::Raster).mean;
+        timings.convert = _profiler.Summarize(Stage::Convert).mean;
+        timings.present = _profiler.Summarize(Stage::Present).mean;
+        timings.frame = _profiler.Summarize(Stage::Frame).mean;
+        timings.frames = _presentedCount;
+        return timings;
     }
 
     void Render()
+    {
+        _profiler.Reset();
+        _presentedCount = 0;
+        _frameTotals = FrameStats();
+        _lastSummary = Clock::now();
+        if (_presentMode == PresentMode::Serial)
+            renderSerial();
+        else
+            renderPipelined(_presentMode == PresentMode::TripleBuffered ? 3 : 2);
+        logSummary();
+
+        SDL_DestroyWindow(_window);
+        SDL_Quit();
+    }
+
+private:
+
+    using Clock = std::chrono::steady_clock;
+
+    // what the render stage hands over to the present stage together with the pixels, the timings it records itself
+    struct FrameStats
+    {
+        RasterStats raster;
+        unsigned long long redrawnPixels = 0;
+        unsigned long long clearedPixels = 0;
+    };
+
+    struct FrameBuffer
+    {
+        std::vector<uint32_t> pixels;
+        std::vector<PixelRect> dirty;   // what changed since these pixels were last drawn
+        std::vector<uint8_t> tilesDirty;
+        FrameStats stats;
+    };
+
+    // what a triangle looked like when it was last drawn
+    struct TriangleState
+    {
+        std::array<Vec3f, 3> vertices;
+        PixelRect bounds{ 0, 0, -1, -1 };
+        bool drawn = false;
+    };
+
+    struct InstanceState
+    {
+        std::vector<PixelRect> bounds;  // per instance, as last transformed
+        std::vector<bool> changed;
+        bool transformed = false;
+    };
+
+    bool quitRequested()
     {
         SDL_Event event;
-        auto timer = TestUtils::Timer();
-        while (true) {
-            SDL_PollEvent(&event);
-            if (event.type == SDL_QUIT) {
-                break;
+        while (SDL_PollEvent(&event))
+        {
+            if (event.type == SDL_QUIT)
+                return true;
+        }
+        return _frameLimit != 0 && _presentedCount >= _frameLimit;
+    }
+
+    void renderSerial()
+    {
+        auto& profile = _profiler.RegisterThread();
+        _renderProfile = &profile;
+        auto frame = FrameStats();
+        auto frameStart = Clock::now();
+        _surfaceDirty.assign(1, PixelRect::Screen(_width, _height));
+        for (unsigned long long frameNumber = 0; !quitRequested(); frameNumber++) {
+            beginFrame(frameNumber);
+            _surfaceDirty.insert(_surfaceDirty.end(), _changes.begin(), _changes.end());
+            _changes.clear();
+
+            if (SDL_MUSTLOCK(_surface))
+                SDL_LockSurface(_surface);
+            renderFrame(_pixels, _pitch, _surfaceDirty, _surfaceTilesDirty, frame);
+            if (SDL_MUSTLOCK(_surface))
+                SDL_UnlockSurface(_surface);
+
+            {
+                TR_TRACE_SCOPE("present");
+                auto timer = ScopedStageTimer(profile, Stage::Present);
+                SDL_UpdateWindowSurface(_window);
+            }
+            const auto now = Clock::now();
+            profile.Record(Stage::Frame, now - frameStart);
+            frameStart = now;
+            framePresented(frame);
+        }
+    }
+
+    // The calling thread polls events and presents, a render thread produces the frames. Frame n is rendered in
+    // buffer n % bufferCount, the only thing the threads share are the counts of rendered and presented frames:
+    // a buffer is handed over by publishing the rendered count, and given back as soon as it is copied to the surface.
+    void renderPipelined(size_t bufferCount)
+    {
+        _frameBuffers.resize(bufferCount);
+        for (auto& buffer : _frameBuffers)
+        {
+            buffer.pixels.assign(static_cast<size_t>(_width) * _height, _clearColor);
+            buffer.dirty.assign(1, PixelRect::Screen(_width, _height));
+            buffer.tilesDirty.assign(_tilesX * _tilesY, 0);
+        }
+        _renderedFrames.store(0);
+        _presentedFrames.store(0);
+        _rendering.store(true);
+
+        auto renderThread = std::thread([this]() { renderLoop(); });
+
+        auto& profile = _profiler.RegisterThread();
+        auto frameStart = Clock::now();
+        for (unsigned long long frame = 0; !quitRequested(); frame++)
+        {
+            {
+                TR_TRACE_SCOPE("wait for a rendered frame");
+                while (_renderedFrames.load(std::memory_order_acquire) <= frame)
+                    std::this_thread::yield();
+            }
+            const auto& buffer = _frameBuffers[frame % bufferCount];
+
+            {
+                TR_TRACE_SCOPE("convert");
+                auto timer = ScopedStageTimer(profile, Stage::Convert);
+                if (SDL_MUSTLOCK(_surface))
+                    SDL_LockSurface(_surface);
+                for (auto j = 0u; j < _height; j++)
+                    std::copy_n(buffer.pixels.data() + j * _width, _width, _pixels + j * _pitch);
+                if (SDL_MUSTLOCK(_surface))
+                    SDL_UnlockSurface(_surface);
             }
-            timer.Reset();
+            // the stats are read before the buffer is given back to the render thread
+            const auto stats = buffer.stats;
+            _presentedFrames.store(frame + 1, std::memory_order_release);
 
+            {
+                TR_TRACE_SCOPE("present");
+                auto timer = ScopedStageTimer(profile, Stage::Present);
+                SDL_UpdateWindowSurface(_window);
+            }
+            const auto now = Clock::now();
+            profile.Record(Stage::Frame, now - frameStart);
+            frameStart = now;
+            framePresented(stats);
+        }
 
-            // clear pixels
+        _rendering.store(false);
+        renderThread.join();
+    }
+
+    void renderLoop()
+    {
+        _renderProfile = &_profiler.RegisterThread();
+        const auto bufferCount = _frameBuffers.size();
+        for (unsigned long long frame = 0; ; frame++)
+        {
+            // the buffer is free once the frame rendered bufferCount frames ago has been presented
             {
-                std::fill(_pixelColors.begin(), _pixelColors.end(), Color(0, 0, 0, 255));
+                TR_TRACE_SCOPE("wait for a free buffer");
+                while (frame >= _presentedFrames.load(std::memory_order_acquire) + bufferCount)
+                {
+                    if (!_rendering.load(std::memory_order_relaxed))
+                        return;
+                    std::this_thread::yield();
+                }
             }
-            // process triangles
+            if (!_rendering.load(std::memory_order_relaxed))
+                return;
+
+            // every buffer still shows an older frame, the changes are owed to all of them
+            beginFrame(frame);
+            for (auto& pending : _frameBuffers)
+                pending.dirty.insert(pending.dirty.end(), _changes.begin(), _changes.end());
+            _changes.clear();
+
+            auto& buffer = _frameBuffers[frame % bufferCount];
+            renderFrame(buffer.pixels.data(), _width, buffer.dirty, buffer.tilesDirty, buffer.stats);
+            _renderedFrames.store(frame + 1, std::memory_order_release);
+        }
+    }
+
+    void beginFrame(unsigned long long frame)
+    {
+        if (_frameCallback)
+            _frameCallback(frame);
+        const auto start = Clock::now();
+        collectChanges();
+        _collectTime = Clock::now() - start;
+    }
+
+    // Adds to _changes the screen regions whose content differs from the previous frame: where modified geometry
+    // was drawn and where it is now. Instance batches are only transformed again after they were updated.
+    void collectChanges()
+    {
+        TR_TRACE_SCOPE("SdlRenderer::collectChanges");
+        const auto screen = PixelRect::Screen(_width, _height);
+        for (size_t i = 0; i < _triangles.size(); i++)
+        {
+            const auto& vertices = _triangles[i].first->m_data;
+            auto& state = _triangleStates[i];
+            if (state.drawn && state.vertices == vertices)
+                continue;
+            if (state.drawn)
+                _changes.push_back(state.bounds);
+            state.vertices = vertices;
+            state.bounds = PixelRect::Bounding(vertices[0], vertices[1], vertices[2], screen);
+            state.drawn = true;
+            _changes.push_back(state.bounds);
+        }
+
+        for (size_t batch = 0; batch < _instanceBatches.size(); batch++)
+        {
+            auto& state = _instanceStates[batch];
+            if (state.transformed)
+                continue;
+            // all instances of a batch are transformed together
+            const auto& instances = _instanceBatches[batch];
+            const auto& vertices = _transformedInstances[batch];
+            TransformInstances(instances, _transformedInstances[batch], _instanceGeometry);
+            const auto vertexCount = instances.TrianglesPerInstance() * 3;
+            state.bounds.assign(instances.InstanceCount(), PixelRect{ 0, 0, -1, -1 });
+            for (size_t instance = 0; instance < instances.InstanceCount(); instance++)
             {
-                for (const auto& [t, color] : _triangles)
+                const auto first = instance * vertexCount;
+                for (size_t v = 0; v < vertexCount; v += 3)
                 {
-                    const auto& p1 = t->m_data[0];
-                    const auto& p2 = t->m_data[1];
-                    const auto& p3 = t->m_data[2];
-
-                    auto bb = findBB(p1, p2, p3);
-
-                    for (auto x = bb.minX; x <= bb.maxX; x++)
-                    {
-                        for (auto y = bb.minY; y <= bb.maxY; y++)
-                        {
-                            auto bc = barycentric(p1, p2, p3, { x, y });
-                            if (bc.X() < 0 || bc.Y() < 0 || bc.Z() < 0)
-                                continue;
-                            auto z = p1.Z() * bc.X() + p2.Z() * bc.Y() + p3.Z() * bc.Z();
-                            if (z >= _zBuffer[static_cast<int>(x + y * _width)])
-                            {
-                                _zBuffer[static_cast<int>(x + y * _width)] = z;
-                                _pixelColors[x + y * _width] = color;
-                            }
-                        }
-                    }
+                    const auto bounds = PixelRect::Bounding(vertices[first + v], vertices[first + v + 1], vertices[first + v + 2], screen);
+                    if (!bounds.Empty())
+                        state.bounds[instance] = state.bounds[instance].Empty() ? bounds : state.bounds[instance].Union(bounds);
                 }
+                if (state.changed[instance])
+                    _changes.push_back(state.bounds[instance]);
             }
+            state.changed.assign(instances.InstanceCount(), false);
+            state.transformed = true;
+        }
 
-            for (auto j = 0; j < _height; j++)
-                for (auto i = 0; i < _width; i++)
+        _changes.erase(std::remove_if(_changes.begin(), _changes.end(), [](const PixelRect& r) { return r.Empty(); }), _changes.end());
+    }
+
+    // Overlapping rectangles are merged so that no pixel is cleared or drawn twice,
+    // once they add up to half the screen one full redraw is cheaper than many small ones.
+    void coalesce(std::vector<PixelRect>& rects) const
+    {
+        const auto screen = PixelRect::Screen(_width, _height);
+        const auto fullRedraw = std::vector<PixelRect>(1, screen);
+        if (!_incremental || rects.size() > MaxDirtyRects)
+        {
+            rects = fullRedraw;
+            return;
+        }
+
+        for (size_t i = 0; i < rects.size();)
+        {
+            auto merged = false;
+            for (size_t j = i + 1; j < rects.size() && !merged; j++)
+            {
+                if (!rects[i].Intersects(rects[j]))
+                    continue;
+                rects[i] = rects[i].Union(rects[j]);
+                rects.erase(rects.begin() + j);
+                merged = true;
+            }
+            // a grown rectangle can overlap one that was already checked
+            i = merged ? 0 : i + 1;
+        }
+
+        auto area = 0ll;
+        for (const auto& rect : rects)
+            area += rect.Area();
+        if (area * 2 > screen.Area())
+            rects = fullRedraw;
+    }
+
+    // Full redraws are cleared lazily: a tile is cleared by the first triangle whose bounds touch it in the frame,
+    // and after rasterization only the tiles left untouched that still hold something are cleared.
+    // Tiles that stay empty frame after frame are never written at all.
+    void renderFrame(uint* target, uint pitch, std::vector<PixelRect>& dirty, std::vector<uint8_t>& tilesDirty, FrameStats& frame)
+    {
+        TR_TRACE_SCOPE("SdlRenderer::renderFrame");
+        _target = target;
+        _targetPitch = pitch;
+        _colorTilesDirty = &tilesDirty;
+        coalesce(dirty);
+
+        if (++_generation == 0)
+        {
+            std::fill(_tileGenerations.begin(), _tileGenerations.end(), 0);
+            _generation = 1;
+        }
+        frame.redrawnPixels = 0;
+        for (const auto& rect : dirty)
+            frame.redrawnPixels += rect.Area();
+        _lazyClear = frame.redrawnPixels == static_cast<unsigned long long>(_width) * _height;
+        _clearedPixels = 0;
+
+        auto start = Clock::now();
+        // otherwise clear pixels straight in the target memory and reset the depth, only where something changed
+        if (!_lazyClear)
+        {
+            for (const auto& rect : dirty)
+                clearRect(rect, true, true);
+        }
+        auto clearTime = Clock::now() - start;
+
+        start = Clock::now();
+        if (!dirty.empty())
+            sortTriangles();
+        _renderProfile->Record(Stage::Vertex, _collectTime + (Clock::now() - start));
+
+        start = Clock::now();
+        _rasterStats = RasterStats();
+        // process triangles, every dirty region on its own with the rasterizers scissored to it
+        if (!dirty.empty())
+        {
+            for (const auto& rect : dirty)
+            {
+                if (_depthPrePass)
                 {
-                    const auto& c = _pixelColors[i + j * _width];
-                    _pixels[i + j * _width] = SDL_MapRGBA(_surface->format, c.r, c.g, c.b, c.a);
+                    drawTriangles(DepthPass::DepthOnly, rect);
+                    drawInstances(DepthPass::DepthOnly, rect);
                 }
+                const auto pass = _depthPrePass ? DepthPass::EqualShading : DepthPass::Combined;
+                drawTriangles(pass, rect);
+                drawInstances(pass, rect);
+            }
+        }
+        dirty.clear();
+        _renderProfile->Record(Stage::Raster, Clock::now() - start);
 
-            SDL_UpdateWindowSurface(_window);
-            spdlog::info("fps: {}", 1. / timer.Elapsed() * 1000);
+        // the tiles cleared on first touch are counted in the raster time, what is left counts as clear
+        if (_lazyClear)
+        {
+            start = Clock::now();
+            for (size_t tile = 0; tile < _tileGenerations.size(); tile++)
+            {
+                if (_tileGenerations[tile] != _generation && (tilesDirty[tile] || _depthTilesDirty[tile]))
+                    clearTile(tile);
+            }
+            clearTime += Clock::now() - start;
         }
+        _renderProfile->Record(Stage::Clear, clearTime);
+        frame.raster = _rasterStats;
+        frame.clearedPixels = _clearedPixels;
+    }
 
-        SDL_DestroyWindow(_window);
-        SDL_Quit();
+    void clearRect(const PixelRect& rect, bool color, bool depth)
+    {
+        const auto width = rect.maxX - rect.minX + 1;
+        for (auto j = rect.minY; j <= rect.maxY; j++)
+        {
+            if (color)
+                std::fill_n(_target + j * _targetPitch + rect.minX, width, _clearColor);
+            if (depth)
+                std::fill_n(_zBuffer.begin() + j * _width + rect.minX, width, std::numeric_limits<double>::lowest());
+        }
+        if (color)
+            _clearedPixels += rect.Area();
     }
 
-private:
+    PixelRect tileRect(size_t tile) const
+    {
+        const auto x = static_cast<int>(tile % _tilesX) * TileWidth;
+        const auto y = static_cast<int>(tile / _tilesX) * TileHeight;
+        return { x, y, std::min<int>(x + TileWidth, _width) - 1, std::min<int>(y + TileHeight, _height) - 1 };
+    }
+
+    void clearTile(size_t tile)
+    {
+        clearRect(tileRect(tile), (*_colorTilesDirty)[tile] != 0, _depthTilesDirty[tile] != 0);
+        (*_colorTilesDirty)[tile] = 0;
+        _depthTilesDirty[tile] = 0;
+    }
+
+    // Tiles a triangle can write to, done per triangle on its bounds so fragments never check anything.
+    // The first touch in a frame clears the tile on lazy frames, from then on it counts as dirty.
+    void touchTiles(const PixelRect& bounds)
+    {
+        if (bounds.Empty())
+            return;
+        for (auto ty = bounds.minY / TileHeight; ty <= bounds.maxY / TileHeight; ty++)
+        {
+            for (auto tx = bounds.minX / TileWidth; tx <= bounds.maxX / TileWidth; tx++)
+            {
+                const auto tile = static_cast<size_t>(ty) * _tilesX + tx;
+                if (_tileGenerations[tile] == _generation)
+                    continue;
+                if (_lazyClear)
+                    clearTile(tile);
+                _tileGenerations[tile] = _generation;
+                (*_colorTilesDirty)[tile] = 1;
+                _depthTilesDirty[tile] = 1;
+            }
+        }
+    }
+
+    // only sums up the counters, the timings are already in the profiler, nothing is logged but the periodic summary
+    void framePresented(const FrameStats& frame)
+    {
+        _frameTotals.raster += frame.raster;
+        _frameTotals.redrawnPixels += frame.redrawnPixels;
+        _frameTotals.clearedPixels += frame.clearedPixels;
+        _presentedCount++;
+
+        if (_profileInterval > 0. && std::chrono::duration<double>(Clock::now() - _lastSummary).count() >= _profileInterval)
+        {
+            logSummary();
+            _lastSummary = Clock::now();
+        }
+    }
+
+    void logSummary() const
+    {
+        if (_presentedCount == 0)
+            return;
+
+        // the old path cleared and wrote 8 byte Colors (they carried an int bytespp), then read them all back to write
+        // the surface, pipelining adds one read and one write of every pixel to copy the finished buffer
+        const auto oldColorSize = 8.;
+        const auto frames = static_cast<double>(_presentedCount);
+        const auto fragments = _frameTotals.raster.fragmentsWritten / frames;
+        const auto cleared = _frameTotals.clearedPixels / frames;
+        const auto pixelCount = static_cast<double>(_width) * _height;
+        const auto copied = _presentMode == PresentMode::Serial ? 0. : 2. * pixelCount;
+        const auto written = (cleared + fragments + copied) * sizeof(uint32_t);
+        const auto previously = (pixelCount + fragments) * oldColorSize + pixelCount * (oldColorSize + sizeof(uint32_t));
+        spdlog::info("{} frames, {:.1f} fps, per frame: fragments written {:.0f}, redrawn pixels {:.0f}, cleared pixels {:.0f}, "
+            "framebuffer traffic {:.2f} MB (saved {:.2f} MB)",
+            _presentedCount, 1000. / _profiler.Summarize(Stage::Frame).mean, fragments, _frameTotals.redrawnPixels / frames, cleared,
+            written / (1 << 20), (previously - written) / (1 << 20));
+        _frameTotals.raster.Log("rasterizer, all frames");
+        _profiler.LogSummary("stage timings:");
+    }
 
     struct BoundingBox
     {
@@ -145,20 +618,164 @@ private:
     {
         auto minMaxX = std::minmax({ p1.X(), p2.X(), p3.X() });
         auto minMaxY = std::minmax({ p1.Y(), p2.Y(), p3.Y() });
-        auto minX = minMaxX.first;
+        auto minX = std::max(0., minMaxX.first);
         auto maxX = std::min(_width - 1., minMaxX.second);
-        auto minY = minMaxY.first;
+        auto minY = std::max(0., minMaxY.first);
         auto maxY = std::min(_height - 1., minMaxY.second);
         return { minX, maxX, minY, maxY };
     }
 
+    // the surface format is only looked at once, colors are packed once per triangle and written as is
+    void detectPixelFormat()
+    {
+        const auto* format = _surface->format;
+        if (format->BytesPerPixel != sizeof(uint32_t)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Unsupported surface format, %d bytes per pixel", format->BytesPerPixel);
+        }
+        _pitch = _surface->pitch / sizeof(uint32_t);
+        _rShift = format->Rshift;
+        _gShift = format->Gshift;
+        _bShift = format->Bshift;
+        _aShift = format->Ashift;
+        _hasAlpha = format->Amask != 0;
+        _clearColor = packColor(Color(0, 0, 0, 255));
+    }
+
+    uint32_t packColor(const Color& c) const
+    {
+        return (uint32_t(c.r) << _rShift) | (uint32_t(c.g) << _gShift) | (uint32_t(c.b) << _bShift) | (_hasAlpha ? uint32_t(c.a) << _aShift : 0u);
+    }
+
+    void sortTriangles()
+    {
+        TR_TRACE_SCOPE("SdlRenderer::sortTriangles");
+        if (_drawOrder == DrawOrder::FrontToBack)
+        {
+            _triangleDepths.resize(_triangles.size());
+            for (size_t i = 0; i < _triangles.size(); i++)
+            {
+                const auto& p = _triangles[i].first->m_data;
+                _triangleDepths[i] = p[0].Z() + p[1].Z() + p[2].Z();
+            }
+            SortFrontToBack(_triangleDepths, _drawOrderIndices);
+            return;
+        }
+        _drawOrderIndices.resize(_triangles.size());
+        std::iota(_drawOrderIndices.begin(), _drawOrderIndices.end(), 0u);
+    }
+
+    void drawTriangles(DepthPass pass, const PixelRect& scissor)
+    {
+        TR_TRACE_SCOPE("SdlRenderer::drawTriangles");
+        _rasterStats.submitted += _drawOrderIndices.size();
+        for (const auto idx : _drawOrderIndices)
+        {
+            if (!_triangleStates[idx].bounds.Intersects(scissor))
+            {
+                _rasterStats.culled++;
+                continue;
+            }
+            const auto& t = _triangles[idx].first;
+            drawTriangle(t->m_data[0], t->m_data[1], t->m_data[2], _triangles[idx].second, pass, scissor);
+        }
+    }
+
+    void drawInstances(DepthPass pass, const PixelRect& scissor)
+    {
+        TR_TRACE_SCOPE("SdlRenderer::drawInstances");
+        for (size_t batch = 0; batch < _instanceBatches.size(); batch++)
+        {
+            const auto& instances = _instanceBatches[batch];
+            const auto& vertices = _transformedInstances[batch];
+            const auto& bounds = _instanceStates[batch].bounds;
+            const auto vertexCount = instances.TrianglesPerInstance() * 3;
+            _rasterStats.submitted += instances.TrianglesPerInstance() * instances.InstanceCount();
+            for (size_t instance = 0; instance < instances.InstanceCount(); instance++)
+            {
+                if (!bounds[instance].Intersects(scissor))
+                {
+                    _rasterStats.culled += instances.TrianglesPerInstance();
+                    continue;
+                }
+                const auto first = instance * vertexCount;
+                for (size_t v = 0; v < vertexCount; v += 3)
+                    drawTriangle(vertices[first + v], vertices[first + v + 1], vertices[first + v + 2], instances.colors[instance], pass, scissor);
+            }
+        }
+    }
+
+    void drawTriangle(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3, const Color& color, DepthPass pass, const PixelRect& scissor)
+    {
+        const auto packed = packColor(color);
+        touchTiles(PixelRect::Bounding(p1, p2, p3, scissor));
+        const auto fragment = [&](int x, int y, double z)
+        {
+            _rasterStats.coveredPixels++;
+            auto& depth = _zBuffer[x + y * _width];
+            switch (pass)
+            {
+            case DepthPass::Combined:
+                if (z < depth)
+                    return;
+                depth = z;
+                break;
+            case DepthPass::DepthOnly:
+                if (z < depth)
+                    return;
+                depth = z;
+                _rasterStats.depthPasses++;
+                return;
+            case DepthPass::EqualShading:
+                if (z != depth)
+                    return;
+                break;
+            }
+            _rasterStats.depthPasses++;
+            _target[x + y * _targetPitch] = packed;
+            _rasterStats.fragmentsWritten++;
+        };
+
+        _rasterStats.rasterized++;
+        if (_rasterMode == RasterMode::FixedPoint)
+        {
+            _rasterStats.boxPixels += RasterizeFixedPoint(p1, p2, p3, scissor, [&](int x, int y, double b1, double b2, double b3)
+                {
+                    fragment(x, y, p1.Z() * b1 + p2.Z() * b2 + p3.Z() * b3);
+                });
+            return;
+        }
+
+        if (IsDegenerate(p1, p2, p3))
+            return;
+
+        auto bb = findBB(p1, p2, p3);
+        // the scissor skips samples but keeps the ones of a full screen draw, a region drawn again matches its surroundings
+        const auto startX = bb.minX + std::max(0., std::ceil(scissor.minX - bb.minX));
+        const auto startY = bb.minY + std::max(0., std::ceil(scissor.minY - bb.minY));
+        const auto endX = std::min(bb.maxX, scissor.maxX + 1. - 1e-9);
+        const auto endY = std::min(bb.maxY, scissor.maxY + 1. - 1e-9);
+        if (endX >= startX && endY >= startY)
+            _rasterStats.boxPixels += static_cast<uint64_t>(std::floor(endX - startX) + 1) * static_cast<uint64_t>(std::floor(endY - startY) + 1);
+
+        for (auto x = startX; x <= endX; x++)
+        {
+            for (auto y = startY; y <= endY; y++)
+            {
+                auto bc = barycentric(p1, p2, p3, { x, y });
+                if (bc.X() < 0 || bc.Y() < 0 || bc.Z() < 0)
+                    continue;
+                fragment(static_cast<int>(x), static_cast<int>(y), p1.Z() * bc.X() + p2.Z() * bc.Y() + p3.Z() * bc.Z());
+            }
+        }
+    }
+
     Vec3f barycentric(const Vec3f& p1, const Vec3f& p2, const Vec3f& p3, const Vec3f& P)
     {
         const auto u = Vec3f{ {p2.X() - p1.X(), p3.X() - p1.X(), p1.X() - P.X()} }.
             Cross(Vec3f{ p2.Y() - p1.Y(),p3.Y() - p1.Y(), p1.Y() - P.Y() });
         if (std::abs(u.Z()) < 1)
             return { -1., 1., 1. };
-        return Vec3f{ {1. - (u.X() + u.Y()) / u.Z(), u.Y() / u.Z(), u.X() / u.Z()} };
+        return Vec3f{ {1. - (u.X() + u.Y()) / u.Z(), u.X() / u.Z(), u.Y() / u.Z()} };
     }
 
     uint _width;
@@ -169,8 +786,69 @@ private:
     SDL_Surface* _surface;
     uint* _pixels;
     std::vector<double> _zBuffer;
-    std::vector<Color> _pixelColors;
+
+    // surface pixel format, detected once
+    uint _pitch = 0;
+    int _rShift = 16, _gShift = 8, _bShift = 0, _aShift = 24;
+    bool _hasAlpha = true;
+    uint32_t _clearColor = 0;
+
+    // where the frame being rendered goes, the surface itself or one of the pipelined buffers
+    uint* _target = nullptr;
+    uint _targetPitch = 0;
+
+    // pipelined presentation, the frame counts are the only state both threads touch
+    PresentMode _presentMode = PresentMode::Serial;
+    std::vector<FrameBuffer> _frameBuffers;
+    std::atomic<unsigned long long> _renderedFrames{ 0 };
+    std::atomic<unsigned long long> _presentedFrames{ 0 };
+    std::atomic<bool> _rendering{ false };
+    std::function<void(unsigned long long)> _frameCallback;
+    unsigned long long _frameLimit = 0;
+
+    // stage timings, every thread records into its own profile, the counters are summed on the presenting thread
+    FrameProfiler _profiler;
+    ThreadProfile* _renderProfile = nullptr;
+    Clock::duration _collectTime{};
+    double _profileInterval = 5.;
+    Clock::time_point _lastSummary;
+    unsigned long long _presentedCount = 0;
+    FrameStats _frameTotals;
 
     // triangles and other entities
     std::vector<std::pair<std::shared_ptr<MathLib::Triangle3D>, Color>> _triangles;
+    RasterMode _rasterMode = RasterMode::FloatingPoint;
+    DrawOrder _drawOrder = DrawOrder::Submission;
+    bool _depthPrePass = false;
+    std::vector<double> _triangleDepths;
+    std::vector<uint32_t> _drawOrderIndices;
+    RasterStats _rasterStats;      // of the frame being rendered, on the render thread
+
+    // change tracking, what each entity covered when it was last drawn and what changed since
+    static constexpr size_t MaxDirtyRects = 256;
+    bool _incremental = false;
+    std::vector<TriangleState> _triangleStates;
+    std::vector<InstanceState> _instanceStates;
+    std::vector<PixelRect> _changes;
+    std::vector<PixelRect> _surfaceDirty;
+
+    // lazy clears, the frame generation tells which tiles were already touched in the current frame,
+    // the dirty flags which ones hold something else than the clear values. Tiles are short row spans,
+    // clearing one is a few contiguous cache lines where square tiles were a cache miss per row.
+    static constexpr int TileWidth = 64;
+    static constexpr int TileHeight = 1;
+    uint _tilesX = 0;
+    uint _tilesY = 0;
+    uint32_t _generation = 0;
+    bool _lazyClear = false;
+    std::vector<uint32_t> _tileGenerations;
+    std::vector<uint8_t> _depthTilesDirty;
+    std::vector<uint8_t> _surfaceTilesDirty;
+    std::vector<uint8_t>* _colorTilesDirty = nullptr;
+    unsigned long long _clearedPixels = 0;
+
+    // instanced geometry and its per frame transformed vertices
+    std::vector<InstanceBatch<Color>> _instanceBatches;
+    std::vector<TransformedVertices> _transformedInstances;
+    TransformedVertices _instanceGeometry;
 };
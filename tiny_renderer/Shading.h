@@ -0,0 +1,23 @@
+#ifndef Shading_h_include
+#define Shading_h_include
+
+#include <VecN.h>
+
+#include <algorithm>
+
+using namespace MathLib;
+
+enum class ShadingMode
+{
+    Flat,       // the precomputed face normal, one intensity per face
+    Gouraud,    // lighting per vertex, intensities interpolated over the face
+    Phong       // normals interpolated over the face, lighting per pixel
+};
+
+// lightDir points towards the light
+inline double Lambert(const Vec3f& normal, const Vec3f& lightDir)
+{
+    return std::max(0., normal.Dot(lightDir));
+}
+
+#endif
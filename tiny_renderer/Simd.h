@@ -0,0 +1,12 @@
+#ifndef Simd_h_include
+#define Simd_h_include
+
+// SSE2 is part of every x64 target we build for, code using it always keeps a scalar fallback
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TR_SSE2 1
+#include <emmintrin.h>
+#else
+#define TR_SSE2 0
+#endif
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef Texture_h_include
+#define Texture_h_include
+
+#include "tgaimage.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Mipmapped texture, every level is stored as packed BGRA (the TGAColor::val layout) whatever the source format.
+// Texel coordinates given to the samplers are always in level 0 texels, like Model::uv returns them.
+class Texture
+{
+public:
+    enum class Filter
+    {
+        Bilinear,   // bilinear on the closest level
+        Trilinear   // bilinear on the two closest levels, blended
+    };
+
+    enum class Layout
+    {
+        Linear,     // row-major, like TGAImage
+        Tiled4x4    // 4x4 texel tiles of 64 bytes (one cache line), tiles row-major
+    };
+
+    Texture() = default;
+
+    // flipVertically takes the rows bottom up, for images whose first row is the bottom one
+    explicit Texture(const TGAImage& image, Layout layout = Layout::Linear, bool flipVertically = false)
+        :m_layout(layout)
+    {
+        const auto width = image.get_width();
+        const auto height = image.get_height();
+        const auto bytespp = image.get_bytespp();
+        if (width <= 0 || height <= 0 || !image.buffer())
+            return;
+
+        auto base = Level{ width, height, std::vector<uint32_t>(width * height) };
+        for (auto y = 0; y < height; y++)
+        {
+            const auto* src = image.row(flipVertically ? height - 1 - y : y);
+            auto* texel = base.texels.data() + static_cast<size_t>(y) * width;
+            for (auto x = 0; x < width; x++, src += bytespp)
+            {
+                if (bytespp == TGAImage::GRAYSCALE)
+                    texel[x] = 0xff000000u | (src[0] << 16) | (src[0] << 8) | src[0];
+                else
+                    texel[x] = TGAColor(src, bytespp).val | (bytespp == TGAImage::RGB ? 0xff000000u : 0u);
+            }
+        }
+        m_levels.push_back(std::move(base));
+
+        while (m_levels.back().width > 1 || m_levels.back().height > 1)
+            m_levels.push_back(downsample(m_levels.back()));
+
+        // the mips are filtered on the linear layout, swizzle every level once they are all built
+        if (m_layout == Layout::Tiled4x4)
+        {
+            for (auto& level : m_levels)
+                level.texels = tile(level);
+        }
+    }
+
+    Layout GetLayout() const
+    {
+        return m_layout;
+    }
+
+    bool Empty() const
+    {
+        return m_levels.empty();
+    }
+
+    int Levels() const
+    {
+        return static_cast<int>(m_levels.size());
+    }
+
+    int Width(int level = 0) const
+    {
+        return m_levels.empty() ? 0 : m_levels[level].width;
+    }
+
+    int Height(int level = 0) const
+    {
+        return m_levels.empty() ? 0 : m_levels[level].height;
+    }
+
+    // clamps to the edge
+    TGAColor Fetch(int x, int y, int level = 0) const
+    {
+        if (m_levels.empty())
+            return TGAColor();
+        return TGAColor(static_cast<int>(fetch(m_levels[level], x, y)), 4);
+    }
+
+    // level of detail from the screen space derivatives of the (level 0) texel coordinates
+    static double Lod(double dudx, double dvdx, double dudy, double dvdy)
+    {
+        const auto rho = std::max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+        return rho > 0. ? 0.5 * std::log2(rho) : 0.;
+    }
+
+    TGAColor Sample(double u, double v, double lod, Filter filter = Filter::Trilinear) const
+    {
+        if (m_levels.empty())
+            return TGAColor();
+
+        const auto maxLevel = static_cast<double>(m_levels.size() - 1);
+        lod = std::min(std::max(lod, 0.), maxLevel);
+        if (filter == Filter::Bilinear)
+            return TGAColor(static_cast<int>(bilinear(static_cast<int>(lod + 0.5), u, v)), 4);
+
+        const auto level = static_cast<int>(lod);
+        const auto fine = bilinear(level, u, v);
+        if (level == maxLevel)
+            return TGAColor(static_cast<int>(fine), 4);
+        const auto coarse = bilinear(level + 1, u, v);
+        return TGAColor(static_cast<int>(lerp(fine, coarse, static_cast<int>((lod - level) * 256.))), 4);
+    }
+
+private:
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<uint32_t> texels;
+    };
+
+    static int tilesPerRow(int width)
+    {
+        return (width + 3) >> 2;
+    }
+
+    // tiled addresses are separable, the row and the column part can be computed independently
+    static int tiledRow(int y, int width)
+    {
+        return (((y >> 2) * tilesPerRow(width)) << 4) + ((y & 3) << 2);
+    }
+
+    static int tiledColumn(int x)
+    {
+        return ((x >> 2) << 4) + (x & 3);
+    }
+
+    static int tiledIndex(int x, int y, int width)
+    {
+        return tiledRow(y, width) + tiledColumn(x);
+    }
+
+    // row-major to 4x4 tiles, every tile row is one 16 byte copy, sizes are padded up to whole tiles
+    static std::vector<uint32_t> tile(const Level& level)
+    {
+        const auto tilesX = tilesPerRow(level.width);
+        const auto tilesY = (level.height + 3) >> 2;
+        auto tiled = std::vector<uint32_t>(tilesX * tilesY * 16);
+
+        for (auto y = 0; y < tilesY * 4; y++)
+        {
+            const auto* row = level.texels.data() + std::min(y, level.height - 1) * level.width;
+            auto x = 0;
+            for (; x + 4 <= level.width; x += 4)
+            {
+                auto* out = tiled.data() + tiledIndex(x, y, level.width);
+#if TR_SSE2
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)));
+#else
+                std::copy(row + x, row + x + 4, out);
+#endif
+            }
+            // last partial tile, padding repeats the edge texels
+            for (; x < tilesX * 4; x++)
+                tiled[tiledIndex(x, y, level.width)] = row[std::min(x, level.width - 1)];
+        }
+        return tiled;
+    }
+
+    uint32_t fetch(const Level& level, int x, int y) const
+    {
+        x = std::min(std::max(x, 0), level.width - 1);
+        y = std::min(std::max(y, 0), level.height - 1);
+        if (m_layout == Layout::Tiled4x4)
+            return level.texels[tiledIndex(x, y, level.width)];
+        return level.texels[x + y * level.width];
+    }
+
+    // 2x2 box filter, odd sizes drop the last row/column
+    static Level downsample(const Level& src)
+    {
+        auto dst = Level{ std::max(1, src.width / 2), std::max(1, src.height / 2), {} };
+        dst.texels.resize(dst.width * dst.height);
+
+        for (auto y = 0; y < dst.height; y++)
+        {
+            const auto* row0 = src.texels.data() + std::min(2 * y, src.height - 1) * src.width;
+            const auto* row1 = src.texels.data() + std::min(2 * y + 1, src.height - 1) * src.width;
+            auto* out = dst.texels.data() + y * dst.width;
+            auto x = 0;
+#if TR_SSE2
+            // 4 output texels from 8 texels of both source rows, the channels summed on 16 bits and rounded like
+            // average does, so every column of a level gets the same filter
+            const auto zero = _mm_setzero_si128();
+            const auto two = _mm_set1_epi16(2);
+            // the two output texels of 4 source texels of both rows, one per 64 bit half
+            const auto pairs = [&](const uint32_t* top, const uint32_t* bottom)
+            {
+                const auto t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top));
+                const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom));
+                const auto low = _mm_add_epi16(_mm_unpacklo_epi8(t, zero), _mm_unpacklo_epi8(b, zero));
+                const auto high = _mm_add_epi16(_mm_unpackhi_epi8(t, zero), _mm_unpackhi_epi8(b, zero));
+                const auto sum = _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+                return _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+            };
+            for (; src.width >= 2 && 2 * x + 8 <= src.width; x += 4)
+            {
+                const auto first = pairs(row0 + 2 * x, row1 + 2 * x);
+                const auto second = pairs(row0 + 2 * x + 4, row1 + 2 * x + 4);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(first, second));
+            }
+#endif
+            for (; x < dst.width; x++)
+            {
+                const auto x0 = std::min(2 * x, src.width - 1);
+                const auto x1 = std::min(2 * x + 1, src.width - 1);
+                out[x] = average(row0[x0], row0[x1], row1[x0], row1[x1]);
+            }
+        }
+        return dst;
+    }
+
+    static uint32_t average(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+    {
+        auto result = 0u;
+        for (auto shift = 0; shift < 32; shift += 8)
+        {
+            const auto sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff) + ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+            result |= ((sum + 2) / 4) << shift;
+        }
+        return result;
+    }
+
+    // a * (256 - weight) + b * weight, weight in [0, 256]
+    static uint32_t lerp(uint32_t a, uint32_t b, int weight)
+    {
+#if TR_SSE2
+        const auto zero = _mm_setzero_si128();
+        const auto pa = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(a)), zero);
+        const auto pb = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(b)), zero);
+        const auto sum = _mm_add_epi16(_mm_mullo_epi16(pa, _mm_set1_epi16(static_cast<short>(256 - weight))),
+            _mm_mullo_epi16(pb, _mm_set1_epi16(static_cast<short>(weight))));
+        return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(_mm_srli_epi16(sum, 8), zero)));
+#else
+        auto result = 0u;
+        for (auto shift = 0; shift < 32; shift += 8)
+        {
+            const auto channel = ((a >> shift) & 0xff) * (256 - weight) + ((b >> shift) & 0xff) * weight;
+            result |= (channel >> 8) << shift;
+        }
+        return result;
+#endif
+    }
+
+    uint32_t bilinear(int levelIdx, double u, double v) const
+    {
+        const auto& level = m_levels[levelIdx];
+        const auto scale = 1. / (1 << levelIdx);
+
+        // texel centers are at half integers
+        const auto x = u * scale - 0.5;
+        const auto y = v * scale - 0.5;
+        const auto x0 = static_cast<int>(std::floor(x));
+        const auto y0 = static_cast<int>(std::floor(y));
+        const auto fx = static_cast<int>((x - x0) * 256.);
+        const auto fy = static_cast<int>((y - y0) * 256.);
+
+        // clamp once and address the 2x2 footprint through row and column offsets
+        const auto cx0 = std::min(std::max(x0, 0), level.width - 1);
+        const auto cx1 = std::min(std::max(x0 + 1, 0), level.width - 1);
+        const auto cy0 = std::min(std::max(y0, 0), level.height - 1);
+        const auto cy1 = std::min(std::max(y0 + 1, 0), level.height - 1);
+        const auto tiled = m_layout == Layout::Tiled4x4;
+        const auto* row0 = level.texels.data() + (tiled ? tiledRow(cy0, level.width) : cy0 * level.width);
+        const auto* row1 = level.texels.data() + (tiled ? tiledRow(cy1, level.width) : cy1 * level.width);
+        const auto col0 = tiled ? tiledColumn(cx0) : cx0;
+        const auto col1 = tiled ? tiledColumn(cx1) : cx1;
+
+        const auto t00 = row0[col0];
+        const auto t10 = row0[col1];
+        const auto t01 = row1[col0];
+        const auto t11 = row1[col1];
+#if TR_SSE2
+        // both texels of a row side by side as 8 x u16, filter vertically then fold the right texel onto the left one
+        const auto zero = _mm_setzero_si128();
+        const auto top = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, static_cast<int>(t10), static_cast<int>(t00)), zero);
+        const auto bottom = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, static_cast<int>(t11), static_cast<int>(t01)), zero);
+        const auto column = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(static_cast<short>(256 - fy))),
+            _mm_mullo_epi16(bottom, _mm_set1_epi16(static_cast<short>(fy)))), 8);
+        const auto left = static_cast<short>(256 - fx);
+        const auto right = static_cast<short>(fx);
+        const auto weighted = _mm_mullo_epi16(column, _mm_set_epi16(right, right, right, right, left, left, left, left));
+        const auto sum = _mm_add_epi16(weighted, _mm_srli_si128(weighted, 8));
+        return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(_mm_srli_epi16(sum, 8), zero)));
+#else
+        return lerp(lerp(t00, t01, fy), lerp(t10, t11, fy), fx);
+#endif
+    }
+
+    std::vector<Level> m_levels;
+    Layout m_layout = Layout::Linear;
+};
+
+#endif
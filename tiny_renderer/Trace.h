@@ -0,0 +1,176 @@
+#ifndef Trace_h_include
+#define Trace_h_include
+
+// Timeline markers written as a Chrome trace, to be opened in chrome://tracing or ui.perfetto.dev.
+// Tracing is off unless TINY_RENDERER_TRACE names the output file, e.g. TINY_RENDERER_TRACE=trace.json,
+// then every TR_TRACE_SCOPE records its duration and the file is written when the program exits.
+// Building with TR_TRACE defined to 0 removes the markers entirely.
+
+#ifndef TR_TRACE
+#define TR_TRACE 1
+#endif
+
+#if TR_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Tracer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // the names are never copied, only string literals or other strings living until the exit can be used
+    struct Event
+    {
+        const char* name;
+        int64_t start;      // ns since the tracer started
+        int64_t duration;
+    };
+
+    // Events of one thread, written by it alone: a slot is filled and then published by bumping the count,
+    // once the ring is full the oldest events are overwritten, the file says how many were lost.
+    struct ThreadBuffer
+    {
+        static constexpr size_t Capacity = 1 << 16;
+
+        explicit ThreadBuffer(uint32_t id) : id(id), events(Capacity)
+        {
+        }
+
+        void Push(const char* name, int64_t start, int64_t duration)
+        {
+            const auto count = written.load(std::memory_order_relaxed);
+            events[count % Capacity] = { name, start, duration };
+            written.store(count + 1, std::memory_order_release);
+        }
+
+        uint32_t id;
+        std::vector<Event> events;
+        std::atomic<uint64_t> written{ 0 };
+    };
+
+    static Tracer& Instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // one branch on a flag read once, all the cost when tracing is off
+    static bool Enabled()
+    {
+        static const bool enabled = Instance()._path.size() > 0;
+        return enabled;
+    }
+
+    int64_t Now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _start).count();
+    }
+
+    // the calling thread's buffer, created on its first event, the only time a lock is taken
+    ThreadBuffer& ThisThread()
+    {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _threads.push_back(std::make_unique<ThreadBuffer>(static_cast<uint32_t>(_threads.size() + 1)));
+            buffer = _threads.back().get();
+        }
+        return *buffer;
+    }
+
+    // writes every buffer to the trace file, called at exit, the threads are expected to be done recording by then
+    bool Flush()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_path.empty())
+            return false;
+        auto* file = std::fopen(_path.c_str(), "w");
+        if (!file)
+            return false;
+
+        std::fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        auto first = true;
+        auto dropped = uint64_t(0);
+        for (const auto& thread : _threads)
+        {
+            std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                first ? "" : ",\n", thread->id, thread->id);
+            first = false;
+            const auto written = thread->written.load(std::memory_order_acquire);
+            const auto begin = written > ThreadBuffer::Capacity ? written - ThreadBuffer::Capacity : 0;
+            dropped += begin;
+            for (auto i = begin; i < written; i++)
+            {
+                const auto& event = thread->events[i % ThreadBuffer::Capacity];
+                std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, thread->id, event.start / 1000., event.duration / 1000.);
+            }
+        }
+        std::fprintf(file, "\n],\"otherData\":{\"droppedEvents\":%llu}}\n", static_cast<unsigned long long>(dropped));
+        return std::fclose(file) == 0;
+    }
+
+    ~Tracer()
+    {
+        Flush();
+    }
+
+private:
+    Tracer() : _start(Clock::now())
+    {
+        if (const auto* path = std::getenv("TINY_RENDERER_TRACE"))
+            _path = path;
+    }
+
+    Clock::time_point _start;
+    std::string _path;
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> _threads;
+};
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name) : _name(Tracer::Enabled() ? name : nullptr)
+    {
+        if (_name)
+            _start = Tracer::Instance().Now();
+    }
+
+    ~TraceScope()
+    {
+        if (!_name)
+            return;
+        auto& tracer = Tracer::Instance();
+        tracer.ThisThread().Push(_name, _start, tracer.Now() - _start);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* _name;
+    int64_t _start = 0;
+};
+
+#define TR_TRACE_CONCAT_(a, b) a##b
+#define TR_TRACE_CONCAT(a, b) TR_TRACE_CONCAT_(a, b)
+#define TR_TRACE_SCOPE(name) TraceScope TR_TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#else
+
+#define TR_TRACE_SCOPE(name) ((void)0)
+
+#endif
+
+#endif
@@ -1,4 +1,8 @@
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <numeric>
 
@@ -7,11 +11,22 @@
 #include "../test/TestUtils.h"
 #include "Entities.h"
 #include "ImageRenderer2D.h"
+#include "ImageRenderer3D.h"
 #include "SdlRenderer.h"
+#include "Clipper.h"
+#include "Rasterizer.h"
+#include "Shading.h"
+#include "DrawOrder.h"
+#include "ColorOps.h"
 
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/basic_file_sink.h>
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 using namespace MathLib;
 
 namespace
@@ -22,6 +37,10 @@ namespace
     const int width = 800;
     const int height = 800;
     const int depth = 255;
+    const RasterMode rasterMode = RasterMode::FixedPoint;
+    const ShadingMode shadingMode = ShadingMode::Gouraud;
+    const Vec3f light_dir = Vec3f{ 0., 0., 1. }; // towards the light
+    const Vec3f camera_dir = Vec3f{ 0., 0., 1. }; // towards the camera
 }
 
 void line(int x0, int y0, int x1, int y1, TGAImage& image, const TGAColor& color)
@@ -72,9 +91,9 @@ BB findBB(Vec3f p1, Vec3f p2, Vec3f p3)
 {
     auto minMaxX = std::minmax({ p1.X(), p2.X(), p3.X() });
     auto minMaxY = std::minmax({ p1.Y(), p2.Y(), p3.Y() });
-    auto minX = minMaxX.first;
+    auto minX = std::max(0., minMaxX.first);
     auto maxX = std::min(width - 1., minMaxX.second);
-    auto minY = minMaxY.first;
+    auto minY = std::max(0., minMaxY.first);
     auto maxY = std::min(height - 1., minMaxY.second);
     return { minX, maxX, minY, maxY };
 }
@@ -85,31 +104,125 @@ Vec3f barycentric(Vec3f p1, Vec3f p2, Vec3f p3, Vec3f P)
         Cross(Vec3f{ p2.Y() - p1.Y(),p3.Y() - p1.Y(), p1.Y() - P.Y() });
     if (std::abs(u.Z()) < 1)
         return { -1., 1., 1. };
-    return Vec3f{ {1. - (u.X() + u.Y()) / u.Z(), u.Y() / u.Z(), u.X() / u.Z()} };
+    return Vec3f{ {1. - (u.X() + u.Y()) / u.Z(), u.X() / u.Z(), u.Y() / u.Z()} };
 }
 
-void triangle(Vec3f p1, Vec3f p2, Vec3f p3, const std::vector<Vec2f>& uv, std::vector<double>& zBuffer, TGAImage& image, double intensity, const TGAColor& color)
+// a clipped triangle after the perspective divide, with everything its fragments need
+struct ScreenTriangle
+{
+    Vec3f p[3];
+    Vec2f uv[3];
+    double w[3];
+    Vec3f normals[3];
+    double intensity;
+};
+
+struct RenderTarget
 {
-    auto bb = findBB(p1, p2, p3);
+    TGAImage& image;
+    std::vector<double>& zBuffer;
+    DepthPass pass;
+    unsigned long long shadedFragments;
+    ShadedFragments fragments;
+};
+
+void triangle(const ScreenTriangle& t, const TGAColor& color, const Texture& texture, RenderTarget& target)
+{
+    const auto& p1 = t.p[0];
+    const auto& p2 = t.p[1];
+    const auto& p3 = t.p[2];
+    const auto& uv = t.uv;
+    const auto& normals = t.normals;
+    const auto intensity = t.intensity;
+    auto& zBuffer = target.zBuffer;
+
+    const auto perspective = PerspectiveCorrection(p1, p2, p3, t.w[0], t.w[1], t.w[2]);
+    const auto interpolateUV = [&](double b1, double b2, double b3)
+    {
+        perspective.Correct(b1, b2, b3);
+        return Vec2f{ uv[0].X() * b1 + uv[1].X() * b2 + uv[2].X() * b3, uv[0].Y() * b1 + uv[1].Y() * b2 + uv[2].Y() * b3 };
+    };
+
+    // flat uses the face intensity as is, Gouraud lights the three vertices once per triangle
+    // and Phong lights the interpolated normal for every pixel
+    double vertexIntensity[3] = { intensity, intensity, intensity };
+    if (shadingMode == ShadingMode::Gouraud)
+    {
+        for (auto i = 0; i < 3; i++)
+            vertexIntensity[i] = Lambert(normals[i], light_dir);
+    }
+    const auto shade = [&](double b1, double b2, double b3)
+    {
+        if (shadingMode == ShadingMode::Flat)
+            return intensity;
+        perspective.Correct(b1, b2, b3);
+        if (shadingMode == ShadingMode::Gouraud)
+            return vertexIntensity[0] * b1 + vertexIntensity[1] * b2 + vertexIntensity[2] * b3;
+        auto n = normals[0] * b1 + normals[1] * b2 + normals[2] * b3;
+        n.Normalize();
+        return Lambert(n, light_dir);
+    };
+
+    const auto fragment = [&](int x, int y, double b1, double b2, double b3)
+    {
+        const auto z = p1.Z() * b1 + p2.Z() * b2 + p3.Z() * b3;
+        auto& depth = zBuffer[x + y * width];
+        switch (target.pass)
+        {
+        case DepthPass::Combined:
+            if (z < depth)
+                return;
+            depth = z;
+            break;
+        case DepthPass::DepthOnly:
+            depth = std::max(depth, z);
+            return;
+        case DepthPass::EqualShading:
+            // both passes interpolate z with the exact same arithmetic, so the visible fragment matches bit for bit
+            if (z != depth)
+                return;
+            break;
+        }
+        target.shadedFragments++;
+
+        auto c = color;
+        if (!texture.Empty())
+        {
+            // the uv one pixel to the right and one pixel up give the derivatives for the mip selection
+            const auto& dx = perspective.dBdx;
+            const auto& dy = perspective.dBdy;
+            const auto t = interpolateUV(b1, b2, b3);
+            const auto tx = interpolateUV(b1 + dx[0], b2 + dx[1], b3 + dx[2]);
+            const auto ty = interpolateUV(b1 + dy[0], b2 + dy[1], b3 + dy[2]);
+            const auto lod = Texture::Lod(tx.X() - t.X(), tx.Y() - t.Y(), ty.X() - t.X(), ty.Y() - t.Y());
+            c = texture.Sample(t.X(), t.Y(), lod);
+        }
+        c.a = color.a;
+        // lit with all the other fragments of the triangle once it is rasterized
+        target.fragments.Add(target.image.row(y) + x * target.image.get_bytespp(), c, shade(b1, b2, b3));
+    };
 
-    for (auto x = bb.minX; x <= bb.maxX; x++)
+    if (rasterMode == RasterMode::FixedPoint)
+    {
+        RasterizeFixedPoint(p1, p2, p3, width, height, fragment);
+    }
+    else if (!IsDegenerate(p1, p2, p3))
     {
-        for (auto y = bb.minY; y <= bb.maxY; y++)
+        // the clipper only guarantees the triangle is inside the guard band, the bounding box does the scissoring
+        auto bb = findBB(p1, p2, p3);
+
+        for (auto x = bb.minX; x <= bb.maxX; x++)
         {
-            auto bc = barycentric(p1, p2, p3, { x, y });
-            if (bc.X() < 0 || bc.Y() < 0 || bc.Z() < 0)
-                continue;
-            auto z = p1.Z() * bc.X() + p2.Z() * bc.Y() + p3.Z() * bc.Z();
-            if (static_cast<int>(x + y * width) > zBuffer.size())
-                continue;
-
-            if (z >= zBuffer[static_cast<int>(x + y * width)])
+            for (auto y = bb.minY; y <= bb.maxY; y++)
             {
-                zBuffer[static_cast<int>(x + y * width)] = z;
-                image.set(x, y, TGAColor(color.r*intensity, color.g*intensity, color.b*intensity, color.a));
+                auto bc = barycentric(p1, p2, p3, { x, y });
+                if (bc.X() < 0 || bc.Y() < 0 || bc.Z() < 0)
+                    continue;
+                fragment(static_cast<int>(x), static_cast<int>(y), bc.X(), bc.Y(), bc.Z());
             }
         }
     }
+    target.fragments.Flush(target.image.get_bytespp());
 }
 
 void triangle_tests()
@@ -124,7 +237,7 @@ void triangle_tests()
     //triangle(t2[0], t2[1], t2[2], image, red);
     //triangle(t3[0], t3[1], t3[2], image, green);
 
-    image.flip_vertically(); // I want to have the origin at the left bottom corner of the image
+    image.set_bottom_up(true); // I want to have the origin at the left bottom corner of the image
     image.write_tga_file("output.tga");
 }
 
@@ -162,14 +275,29 @@ Mat4 v2m(const Vec3f& v)
     return m;
 }
 
+Vec4f m2h(const Mat4& m)
+{
+    return Vec4f{ m[0][0], m[1][0], m[2][0], m[3][0] };
+}
 
-void african_head()
+Mat4 h2m(const Vec4f& v)
+{
+    auto m = Mat4();
+    m[0][0] = v[0];
+    m[1][0] = v[1];
+    m[2][0] = v[2];
+    m[3][0] = v[3];
+
+    return m;
+}
+
+
+void african_head(DrawOrder drawOrder = DrawOrder::Submission, bool depthPrePass = false)
 {
     TGAImage image(width, height, TGAImage::RGB);
 
     auto model = Model("obj/african_head.obj");
-    //model.loadTexture("obj/african_head_texture.tga");
-    const auto light_dir = Vec3f{ 0 , 0, -1 };
+    model.loadTexture("obj/african_head_diffuse.tga");
     auto zBuffer = std::vector<double>(width * height, std::numeric_limits<double>::lowest());
 
     auto timer = TestUtils::Timer();
@@ -182,6 +310,16 @@ void african_head()
     auto cameraZdistance = 5.;
     projection[3][2] = -1. / cameraZdistance;
 
+    // with the camera at z = 5 the head spans z/w in [-0.83, 1.25], keep it all inside the near/far planes
+    auto clipVolume = Clipper::Volume();
+    clipVolume.minZ = -2.;
+    clipVolume.maxZ = 2.;
+    const auto clipper = Clipper(clipVolume);
+    auto polygon = Clipper::Polygon();
+
+    // geometry first, the triangles can then be reordered and rasterized more than once
+    auto triangles = std::vector<ScreenTriangle>();
+    triangles.reserve(model.nfaces());
     for (auto i = 0; i < model.nfaces(); i++)
     {
         // each face has 3 lines
@@ -189,7 +327,7 @@ void african_head()
         if (face.empty())
             continue;
 
-        Vec3f screenCoords[3];
+        ClipVertex clipCoords[3];
         Vec3f worldCoords[3];
         for (int j = 0; j < 3; j++)
         {
@@ -197,37 +335,103 @@ void african_head()
 
             //screenCoords[j] = Vec3f{ std::round((worldCoords[j].X() + 1.) * width / 2.), std::round((worldCoords[j].Y() + 1.) * height / 2.), worldCoords[j].Z() };
 
-            auto v = v2m(worldCoords[j]);
-            //screenCoords[j] = m2v(vp * v);
+            clipCoords[j].position = m2h(projection * v2m(worldCoords[j]));
+            const auto uv = model.uv(i, j);
+            clipCoords[j].varyings[0] = uv.X();
+            clipCoords[j].varyings[1] = uv.Y();
+            const auto& normal = model.normal(i, j);
+            clipCoords[j].varyings[2] = normal.X();
+            clipCoords[j].varyings[3] = normal.Y();
+            clipCoords[j].varyings[4] = normal.Z();
+        }
+
+        // the face normals are precomputed by the model, no cross product per frame
+        const auto& faceNormal = model.faceNormal(i);
+        if (faceNormal.Dot(camera_dir) <= 0)
+            continue;
+        const auto intensity = Lambert(faceNormal, light_dir);
 
-            screenCoords[j] = m2v(vp * projection * v);
+        const auto vertexCount = clipper.ClipTriangle(clipCoords[0], clipCoords[1], clipCoords[2], polygon);
+        if (vertexCount == 0)
+            continue;
+
+        // perspective divide and viewport only for what survived the clipping
+        Vec3f screenCoords[Clipper::MaxPolygonVertices];
+        for (auto j = 0; j < vertexCount; j++)
+        {
+            screenCoords[j] = m2v(vp * h2m(polygon[j].position));
             screenCoords[j][0] = std::round(screenCoords[j][0]);
             screenCoords[j][1] = std::round(screenCoords[j][1]);
             screenCoords[j][2] = std::round(screenCoords[j][2]);
         }
 
-        auto n = (worldCoords[2] - worldCoords[0]).Cross(worldCoords[1] - worldCoords[0]);
-        n.Normalize();
-        auto intensity = n.Dot(light_dir);
-
-        if (intensity > 0)
+        // the clipped polygon is convex, draw it as a fan
+        for (auto j = 1; j + 1 < vertexCount; j++)
         {
-            auto uv = std::vector<Vec2f>();
-            uv.resize(3);
+            auto t = ScreenTriangle();
             for (auto vertexIdx = 0; vertexIdx < 3; vertexIdx++) // for each vertex in the face
             {
-                uv[vertexIdx] = model.uv(i, vertexIdx);
+                const auto polygonIdx = vertexIdx == 0 ? 0 : j + vertexIdx - 1;
+                const auto& v = polygon[polygonIdx];
+                t.p[vertexIdx] = screenCoords[polygonIdx];
+                t.uv[vertexIdx] = Vec2f{ v.varyings[0], v.varyings[1] };
+                t.w[vertexIdx] = v.position[3];
+                t.normals[vertexIdx] = Vec3f{ v.varyings[2], v.varyings[3], v.varyings[4] };
             }
-
-            triangle(screenCoords[0], screenCoords[1], screenCoords[2], uv, zBuffer, image, intensity, white);
+            t.intensity = intensity;
+            triangles.push_back(t);
         }
     }
+
+    auto order = std::vector<uint32_t>(triangles.size());
+    if (drawOrder == DrawOrder::FrontToBack)
+    {
+        auto depths = std::vector<double>(triangles.size());
+        for (size_t i = 0; i < triangles.size(); i++)
+            depths[i] = triangles[i].p[0].Z() + triangles[i].p[1].Z() + triangles[i].p[2].Z();
+        SortFrontToBack(depths, order);
+    }
+    else
+    {
+        std::iota(order.begin(), order.end(), 0u);
+    }
+
+    auto target = RenderTarget{ image, zBuffer, DepthPass::Combined, 0, ShadedFragments() };
+    if (depthPrePass)
+    {
+        target.pass = DepthPass::DepthOnly;
+        for (const auto idx : order)
+            triangle(triangles[idx], white, model.texture(), target);
+        target.pass = DepthPass::EqualShading;
+    }
+    for (const auto idx : order)
+        triangle(triangles[idx], white, model.texture(), target);
+
     std::cout << '\n' << timer.Elapsed() << " milliseconds";
 
-    image.flip_vertically(); // I want to have the origin at the left bottom corner of the image
+    // every shaded fragment beyond the covered pixels was overwritten later
+    const auto coveredPixels = std::count_if(zBuffer.begin(), zBuffer.end(), [](double z) { return z != std::numeric_limits<double>::lowest(); });
+    std::cout << '\n' << target.shadedFragments << " fragments shaded for " << coveredPixels << " covered pixels ("
+        << (target.shadedFragments - coveredPixels) << " overdrawn)";
+
+    image.set_bottom_up(true); // I want to have the origin at the left bottom corner of the image
     image.write_tga_file("output.tga");
 }
 
+// how many shaded fragments the draw order and the depth pre-pass save on the head
+void overdrawBenchmark()
+{
+    for (const auto drawOrder : { DrawOrder::Submission, DrawOrder::FrontToBack })
+    {
+        for (const auto depthPrePass : { false, true })
+        {
+            std::cout << "\n\n" << (drawOrder == DrawOrder::FrontToBack ? "front to back" : "submission order")
+                << (depthPrePass ? ", depth pre-pass" : "");
+            african_head(drawOrder, depthPrePass);
+        }
+    }
+}
+
 void transformationTests()
 {
     auto p1 = Point2D({ 2., 2. });
@@ -293,14 +497,648 @@ void perfTest()
     sdl.Render();
 }
 
+// the perfTest scene with the repeated triangles drawn as one instance batch instead of 1000 allocations
+void instancingTest()
+{
+    spdlog::info("Welcome to start of tiny renderer");
+
+    auto sdl = SdlRenderer(640, 480);
+    const auto instanceCount = 1000;
+
+    auto batch = InstanceBatch<Color>();
+    batch.geometry = std::make_shared<const std::vector<Vec3f>>(std::vector<Vec3f>{
+        Vec3f{ 0., 0., 0. }, Vec3f{ 10., 0., 0. }, Vec3f{ 10., 10., 0. },
+        Vec3f{ 0., 0., 0. }, Vec3f{ 10., 10., 0. }, Vec3f{ 0., 10., 0. } });
+    for (auto i = 0; i < instanceCount; i++)
+    {
+        const auto position = Vec3f{ 20. + (i % 40) * 15., 20. + (i / 40) * 17., i * 0.001 };
+        batch.transforms.push_back(AffineTransform::Translation(position) * AffineTransform::RotationZ(i * 7.));
+        batch.colors.push_back(Color(0, 0, 55 + i % 200, 255));
+    }
+
+    // what the same scene costs as one shared Triangle3D per triangle and instance, like perfTest builds it
+    const auto trianglesPerInstance = batch.TrianglesPerInstance();
+    const auto perTriangle = sizeof(MathLib::Triangle3D) + sizeof(std::pair<std::shared_ptr<MathLib::Triangle3D>, Color>);
+    spdlog::info("{} instances of {} triangles", instanceCount, trianglesPerInstance);
+    spdlog::info("  one Triangle3D each: {} bytes ({} allocations)", perTriangle * trianglesPerInstance * instanceCount, trianglesPerInstance * instanceCount);
+    spdlog::info("  instanced: {} bytes of shared geometry + {} bytes per instance (transform {} + color {}) = {} bytes",
+        batch.GeometryBytes(), batch.BytesPerInstance(), sizeof(AffineTransform), sizeof(Color),
+        batch.GeometryBytes() + batch.BytesPerInstance() * instanceCount);
+
+    sdl.AddInstances(batch);
+    sdl.Render();
+}
+
+// the perfTest scene for a fixed number of frames in every present mode, run it with SDL_VIDEODRIVER=dummy
+// on a headless box to compare pure throughput
+void pipelineBenchmark()
+{
+    const auto modes = { std::make_pair(PresentMode::Serial, "serial"),
+        std::make_pair(PresentMode::DoubleBuffered, "double buffered"),
+        std::make_pair(PresentMode::TripleBuffered, "triple buffered") };
+    for (const auto& mode : modes)
+    {
+        auto sdl = SdlRenderer(640, 480);
+        for (int i = 0; i < 1000; i++)
+        {
+            const auto x = 20. + i % 40 * 15.;
+            const auto y = 20. + i / 40 * 17.;
+            auto t = std::make_shared<MathLib::Triangle3D>(Vec3f{ x, y, 0. }, Vec3f{ x + 30., y, 0 }, Vec3f{ x + 30., y + 30., 0 });
+            sdl.AddRectangle(t, Color(0, 0, 55 + i % 200, 255));
+        }
+        sdl.SetPresentMode(mode.first);
+        sdl.SetFrameLimit(300);
+        sdl.Render();
+
+        const auto timings = sdl.GetStageTimings();
+        spdlog::info("{}: {:.1f} fps, clear {:.2f} ms, vertex {:.2f} ms, raster {:.2f} ms, convert {:.2f} ms, present {:.2f} ms, frame {:.2f} ms",
+            mode.second, 1000. / timings.frame, timings.clear, timings.vertex, timings.raster, timings.convert, timings.present, timings.frame);
+    }
+}
+
+// a static scene with a small overlay moving every frame, drawn in full and incrementally
+void dirtyRegionBenchmark()
+{
+    for (const auto incremental : { false, true })
+    {
+        auto sdl = SdlRenderer(640, 480);
+        for (int i = 0; i < 1000; i++)
+        {
+            const auto x = 20. + i % 40 * 15.;
+            const auto y = 20. + i / 40 * 17.;
+            auto t = std::make_shared<MathLib::Triangle3D>(Vec3f{ x, y, 0. }, Vec3f{ x + 30., y, 0 }, Vec3f{ x + 30., y + 30., 0 });
+            sdl.AddRectangle(t, Color(0, 0, 55 + i % 200, 255));
+        }
+        auto overlay = std::make_shared<MathLib::Triangle3D>(Vec3f{ 0., 0., 1. }, Vec3f{ 20., 0., 1. }, Vec3f{ 20., 20., 1. });
+        sdl.AddRectangle(overlay, Color(255, 0, 0, 255));
+        sdl.SetFrameCallback([overlay](unsigned long long frame)
+            {
+                const auto x = 10. + frame % 600;
+                overlay->m_data = { Vec3f{ x, 400., 1. }, Vec3f{ x + 20., 400., 1. }, Vec3f{ x + 20., 420., 1. } };
+            });
+        sdl.SetIncrementalRendering(incremental);
+        sdl.SetFrameLimit(300);
+        sdl.Render();
+
+        const auto timings = sdl.GetStageTimings();
+        spdlog::info("{}: {:.1f} fps, clear {:.3f} ms, raster {:.3f} ms", incremental ? "incremental" : "full redraw",
+            1000. / timings.frame, timings.clear, timings.raster);
+    }
+}
+
+// texel fetch throughput of both texture layouts, on level 0 so every sample really goes to memory
+void textureLayoutBenchmark()
+{
+    auto image = TGAImage();
+    image.read_tga_file("obj/african_head_diffuse.tga");
+
+    const auto linear = Texture(image, Texture::Layout::Linear);
+    const auto tiled = Texture(image, Texture::Layout::Tiled4x4);
+    const auto size = linear.Width();
+
+    struct Pattern
+    {
+        const char* name;
+        double degrees;
+        double scale;
+    };
+    const Pattern patterns[] = {
+        { "rows", 0., 1. },
+        { "columns", 90., 1. },
+        { "rotated 30", 30., 1. },
+        { "rotated 60, magnified 2x", 60., 0.5 },
+        { "rotated 45, minified 2x", 45., 2. },
+    };
+
+    const auto samples = 512;
+    const auto repeats = 20;
+    for (const auto& pattern : patterns)
+    {
+        // walk a samples x samples grid of screen pixels through a rotated and scaled uv mapping
+        const auto rads = d2r(pattern.degrees);
+        const auto dudx = std::cos(rads) * pattern.scale;
+        const auto dvdx = std::sin(rads) * pattern.scale;
+        const auto dudy = -dvdx;
+        const auto dvdy = dudx;
+
+        for (const auto* texture : { &linear, &tiled })
+        {
+            auto checksum = 0u;
+            const auto seconds = TestUtils::Measure(repeats, [&]()
+                {
+                    for (auto y = 0; y < samples; y++)
+                    {
+                        auto u = size / 2. + y * dudy - samples / 2. * (dudx + dudy);
+                        auto v = size / 2. + y * dvdy - samples / 2. * (dvdx + dvdy);
+                        for (auto x = 0; x < samples; x++, u += dudx, v += dvdx)
+                            checksum += texture->Sample(u, v, 0., Texture::Filter::Bilinear).val;
+                    }
+                });
+            spdlog::info("{:<26} {:<6}: {:.1f} Mtexels/s (checksum {})", pattern.name,
+                texture == &linear ? "linear" : "tiled", 4. * samples * samples / seconds / 1e6, checksum);
+        }
+    }
+}
+
+// drops the file from the page cache so the next load really goes to the disk, only where the OS lets us
+bool evictFromCache(const char* filename)
+{
+#if defined(__linux__)
+    const auto fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    const auto evicted = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return evicted;
+#else
+    return false;
+#endif
+}
+
+// streamed vs memory mapped loads of the head texture, uncompressed and RLE, at its size and scaled up to 4096,
+// cold from the disk and warm from the page cache. Every load sums all the pixels: a view is only read when touched.
+void tgaLoadBenchmark()
+{
+    auto source = TGAImage();
+    source.read_tga_file("obj/african_head_diffuse.tga");
+    auto large = source;
+    large.scale(4096, 4096);
+
+    struct File
+    {
+        const char* name;
+        TGAImage* image;
+        bool rle;
+    };
+    const File files[] = {
+        { "load_1024_raw.tga", &source, false },
+        { "load_1024_rle.tga", &source, true },
+        { "load_4096_raw.tga", &large, false },
+        { "load_4096_rle.tga", &large, true },
+    };
+
+    const auto load = [](const char* filename, bool mapped, unsigned long long& checksum)
+    {
+        auto image = TGAImage();
+        const auto loaded = mapped ? image.map_tga_file(filename) : image.read_tga_file(filename);
+        const auto* pixels = static_cast<const TGAImage&>(image).buffer();
+        const auto bytes = static_cast<size_t>(image.get_width()) * image.get_height() * image.get_bytespp();
+        checksum += loaded ? std::accumulate(pixels, pixels + bytes, 0ull) : 0;
+    };
+
+    const auto repeats = 10;
+    for (const auto& file : files)
+    {
+        file.image->write_tga_file(file.name, file.rle);
+        for (const auto mapped : { false, true })
+        {
+            auto checksum = 0ull;
+            const auto evicted = evictFromCache(file.name);
+            const auto cold = TestUtils::Measure(1, [&]() { load(file.name, mapped, checksum); });
+            const auto warm = TestUtils::Measure(repeats, [&]() { load(file.name, mapped, checksum); });
+            spdlog::info("{} {:<8}: cold {} ms, warm {:.2f} ms (checksum {})", file.name, mapped ? "mapped" : "streamed",
+                evicted ? fmt::format("{:.2f}", cold * 1000.) : std::string("n/a"), warm * 1000., checksum / (repeats + 1));
+        }
+    }
+}
+
+std::vector<char> readFile(const char* filename)
+{
+    auto in = std::ifstream(filename, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// RLE encoding speed of the byte by byte encoder write_tga_file used before, then of write_tga_file on one thread
+// and on one per core, in MB/s of pixels, on the head texture at its size and scaled up to 4096. Only the larger
+// one is cut in bands that the threads can share.
+void tgaWriteBenchmark()
+{
+    auto source = TGAImage();
+    source.read_tga_file("obj/african_head_diffuse.tga");
+    auto large = source;
+    large.scale(4096, 4096);
+
+    const auto repeats = 5;
+    for (auto* image : { &source, &large })
+    {
+        const auto megabytes = static_cast<double>(image->get_width()) * image->get_height() * image->get_bytespp() / (1 << 20);
+        const auto legacy = TestUtils::Measure(repeats, [&]()
+            {
+                auto out = std::ofstream("write_legacy.rle", std::ios::binary);
+                TestUtils::LegacyRle(*image, out);
+            });
+        const auto single = TestUtils::Measure(repeats, [&]() { image->write_tga_file("write_rle.tga", true, 1); });
+        const auto perCore = TestUtils::Measure(repeats, [&]() { image->write_tga_file("write_rle.tga", true); });
+        spdlog::info("{}x{}: legacy {:.1f} MB/s, one thread {:.1f} MB/s, {} threads {:.1f} MB/s, {} bytes", image->get_width(),
+            image->get_height(), megabytes / legacy, megabytes / single, std::thread::hardware_concurrency(), megabytes / perCore,
+            readFile("write_rle.tga").size() - 18);
+    }
+}
+
+// QOI against tga, raw and RLE, on the head texture and on a rendered frame of the head: file sizes and MB/s of pixels
+// to write and read the files, then QOI encoding and decoding in memory without the file system
+void qoiBenchmark()
+{
+    auto texture = TGAImage();
+    texture.read_tga_file("obj/african_head_diffuse.tga");
+    auto model = Model("obj/african_head.obj");
+    model.loadTexture("obj/african_head_diffuse.tga");
+    auto renderer = ImageRenderer3D(width, height);
+    renderer.SetRasterMode(rasterMode);
+    renderer.DrawModel(model, Camera());
+    renderer.ExportImage("qoi_frame");
+    auto frame = TGAImage();
+    frame.read_tga_file("qoi_frame.tga");
+
+    const auto fileSize = [](const char* filename) { return static_cast<long long>(readFile(filename).size()); };
+
+    struct Format
+    {
+        const char* name;
+        const char* filename;
+        std::function<bool(TGAImage&, const char*)> write;
+        std::function<bool(TGAImage&, const char*)> read;
+    };
+    const Format formats[] = {
+        { "tga raw", "codec.tga", [](TGAImage& image, const char* f) { return image.write_tga_file(f, false); }, [](TGAImage& image, const char* f) { return image.read_tga_file(f); } },
+        { "tga rle", "codec_rle.tga", [](TGAImage& image, const char* f) { return image.write_tga_file(f, true); }, [](TGAImage& image, const char* f) { return image.read_tga_file(f); } },
+        { "qoi", "codec.qoi", [](TGAImage& image, const char* f) { return image.write_qoi_file(f); }, [](TGAImage& image, const char* f) { return image.read_qoi_file(f); } },
+    };
+
+    const auto repeats = 10;
+    for (auto* image : { &texture, &frame })
+    {
+        const auto name = image == &texture ? "texture" : "frame";
+        const auto bytes = static_cast<size_t>(image->get_width()) * image->get_height() * image->get_bytespp();
+        const auto megabytes = static_cast<double>(bytes) / (1 << 20);
+        for (const auto& format : formats)
+        {
+            auto decoded = TGAImage();
+            const auto written = TestUtils::Measure(repeats, [&]() { format.write(*image, format.filename); });
+            const auto read = TestUtils::Measure(repeats, [&]() { format.read(decoded, format.filename); });
+            const auto size = fileSize(format.filename);
+            spdlog::info("{:<7} {:<7}: {} bytes ({:.1f}% of the pixels), write {:.1f} MB/s, read {:.1f} MB/s", name, format.name, size,
+                100. * size / bytes, megabytes / written, megabytes / read);
+        }
+
+        auto encoded = std::vector<unsigned char>();
+        auto decoded = TGAImage();
+        const auto encoding = TestUtils::Measure(repeats, [&]() { image->encode_qoi(encoded); });
+        const auto decoding = TestUtils::Measure(repeats, [&]() { decoded.decode_qoi(encoded.data(), encoded.size()); });
+        spdlog::info("{:<7} qoi in memory: encode {:.1f} MB/s, decode {:.1f} MB/s", name, megabytes / encoding, megabytes / decoding);
+    }
+}
+
+// writing a 4096 x 4096 image pixel by pixel through set, through typed rows, and a row at a time with fill_span
+void spanBenchmark()
+{
+    const auto size = 4096;
+    auto image = TGAImage(size, size, TGAImage::RGB);
+    const auto megabytes = 3. * size * size / (1 << 20);
+    const auto color = TGAColor(200, 100, 50, 255);
+    const auto repeats = 5;
+
+    const auto measure = [&](const char* name, const std::function<void()>& fill)
+    {
+        const auto seconds = TestUtils::Measure(repeats, fill);
+        spdlog::info("{:<10}: {:.1f} MB/s (pixel {:x})", name, megabytes / seconds, image.get(size - 1, size - 1).val & 0xffffff);
+        image.clear();
+    };
+
+    measure("set", [&]()
+        {
+            for (auto y = 0; y < size; y++)
+                for (auto x = 0; x < size; x++)
+                    image.set(x, y, color);
+        });
+    measure("row_span", [&]()
+        {
+            for (auto y = 0; y < size; y++)
+            {
+                const auto row = image.row_span<RGB8>(y);
+                for (auto x = 0; x < size; x++)
+                    row[x] = RGB8{ color.b, color.g, color.r };
+            }
+        });
+    measure("fill_span", [&]()
+        {
+            for (auto y = 0; y < size; y++)
+                image.fill_span(0, y, size, color);
+        });
+}
+
+// the batched color operations against the same work done one channel at a time, in millions of colors per second;
+// test/ColorOpsTesting.cpp checks they give the same bytes
+void colorOpsBenchmark()
+{
+    const auto count = size_t(1) << 20;
+    auto colors = std::vector<TGAColor>(count);
+    auto under = std::vector<TGAColor>(count);
+    auto intensities = std::vector<double>(count);
+    auto seed = 12345u;
+    for (size_t i = 0; i < count; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        colors[i].val = seed;
+        under[i].val = seed * 7u;
+        intensities[i] = (seed >> 8 & 0xffff) / 65535.;
+    }
+    auto scalar = std::vector<TGAColor>(count);
+    auto batched = std::vector<TGAColor>(count);
+    const int order[4] = { 2, 1, 0, 3 };
+
+    const auto repeats = 20;
+    const auto measure = [&](const std::function<void()>& work) { return count / TestUtils::Measure(repeats, work) / 1e6; };
+    const auto report = [&](const char* name, double perChannel, double batch)
+    {
+        spdlog::info("{:<12}: per channel {:.0f} M/s, batched {:.0f} M/s", name, perChannel, batch);
+    };
+
+    report("intensity", measure([&]()
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                const auto& c = colors[i];
+                scalar[i] = TGAColor(c.r * intensities[i], c.g * intensities[i], c.b * intensities[i], c.a);
+            }
+        }), measure([&]() { ColorOps::ScaleIntensity(colors.data(), intensities.data(), batched.data(), count); }));
+    report("swizzle", measure([&]()
+        {
+            for (size_t i = 0; i < count; i++)
+                for (auto k = 0; k < 4; k++)
+                    scalar[i].raw[k] = colors[i].raw[order[k]];
+        }), measure([&]() { ColorOps::Swizzle(colors.data(), batched.data(), count, order); }));
+    report("premultiply", measure([&]()
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                const auto& c = colors[i];
+                scalar[i] = TGAColor(c.r * c.a / 255. + .5, c.g * c.a / 255. + .5, c.b * c.a / 255. + .5, c.a);
+            }
+        }), measure([&]() { ColorOps::Premultiply(colors.data(), batched.data(), count); }));
+
+    // the blend works in place, every run starts again from the same colors under the premultiplied ones
+    auto premultiplied = std::vector<TGAColor>(count);
+    ColorOps::Premultiply(colors.data(), premultiplied.data(), count);
+    report("blend", measure([&]()
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                const auto& s = premultiplied[i];
+                for (auto k = 0; k < 4; k++)
+                    scalar[i].raw[k] = static_cast<unsigned char>(std::min(255., s.raw[k] + under[i].raw[k] * (255 - s.a) / 255. + .5));
+            }
+        }), measure([&]()
+        {
+            std::copy(under.begin(), under.end(), batched.begin());
+            ColorOps::BlendPremultiplied(premultiplied.data(), batched.data(), count);
+        }));
+}
+
+// thumbnails and mip levels of the head texture through each filter and thread count, against the nearest pixel scale,
+// in megapixels of the source image per second
+void resampleBenchmark()
+{
+    auto texture = TGAImage();
+    texture.read_tga_file("obj/african_head_diffuse.tga");
+    auto poster = texture;
+    poster.resample(4096, 4096, TGAImage::BILINEAR);
+
+    struct Case
+    {
+        const char* name;
+        const TGAImage& source;
+        int width;
+        int height;
+    };
+    const Case cases[] = {
+        { "thumbnail 4096 -> 256", poster, 256, 256 },
+        { "mip 1024 -> 512", texture, 512, 512 },
+        { "upscale 1024 -> 2048", texture, 2048, 2048 },
+    };
+    const struct { const char* name; TGAImage::Filter filter; } filters[] = {
+        { "box", TGAImage::BOX }, { "bilinear", TGAImage::BILINEAR }, { "lanczos3", TGAImage::LANCZOS3 } };
+
+    const auto repeats = 5;
+    const auto measure = [&](const Case& c, const std::function<void(TGAImage&)>& resize)
+    {
+        // the copy of the source each run starts from is left out of the time
+        auto seconds = 0.;
+        auto timer = TestUtils::Timer();
+        for (auto r = 0; r < repeats; r++)
+        {
+            auto image = c.source;
+            timer.Reset();
+            resize(image);
+            seconds += timer.Seconds();
+        }
+        return static_cast<double>(c.source.get_width()) * c.source.get_height() * repeats / seconds / 1e6;
+    };
+
+    for (const auto& c : cases)
+    {
+        spdlog::info("{:<22} nearest : {:.1f} Mpixels/s", c.name, measure(c, [&](TGAImage& image) { image.scale(c.width, c.height); }));
+        for (const auto& f : filters)
+        {
+            for (auto threads : { 1, 2, 4 })
+            {
+                spdlog::info("{:<22} {:<8}: {:.1f} Mpixels/s on {} threads", c.name, f.name,
+                    measure(c, [&](TGAImage& image) { image.resample(c.width, c.height, f.filter, threads); }), threads);
+            }
+        }
+    }
+
+    auto thumbnail = poster;
+    thumbnail.resample(256, 256);
+    thumbnail.write_tga_file("thumbnail.tga");
+}
+
+// the in-place transforms on 4096 x 4096 and 4096 x 3096 images, in MB/s of pixels; test/TgaImageTesting.cpp
+// checks them against get and set
+void transformBenchmark()
+{
+    const auto size = 4096;
+    for (auto bpp : { TGAImage::GRAYSCALE, TGAImage::RGB, TGAImage::RGBA })
+    {
+        auto source = TGAImage(size, size - 1000, bpp);
+        auto seed = 12345u;
+        for (auto y = 0; y < source.get_height(); y++)
+        {
+            auto* row = source.row(y);
+            for (auto i = 0; i < size * bpp; i++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                row[i] = static_cast<unsigned char>(seed >> 24);
+            }
+        }
+
+        const std::pair<const char*, std::function<bool(TGAImage&)>> transforms[] = {
+            { "flip horizontally", [](TGAImage& image) { return image.flip_horizontally(); } },
+            { "flip vertically", [](TGAImage& image) { return image.flip_vertically(); } },
+            { "transpose", [](TGAImage& image) { return image.transpose(); } },
+            { "rotate cw", [](TGAImage& image) { return image.rotate_90(true); } },
+            { "rotate ccw", [](TGAImage& image) { return image.rotate_90(false); } },
+        };
+        for (const auto& transform : transforms)
+        {
+            for (auto square : { true, false })
+            {
+                auto input = source;
+                if (square)
+                    input.resample(size, size, TGAImage::BOX);
+                // four times over the same image, the number of pixels moved doesn't change
+                auto image = input;
+                const auto seconds = TestUtils::Measure(4, [&]() { transform.second(image); });
+                const auto megabytes = static_cast<double>(input.get_width()) * input.get_height() * bpp / (1 << 20);
+                spdlog::info("{} bpp {:<17} {:<6}: {:.1f} MB/s", bpp, transform.first, square ? "square" : "wide", megabytes / seconds);
+            }
+        }
+    }
+}
+
+// Render and export loops over jobs of a few sizes, each frame copied out and given a thumbnail like a job exporting
+// previews would: the pixel buffers taken from the heap per frame, without and with a buffer pool.
+void allocBenchmark()
+{
+    auto model = Model("obj/african_head.obj");
+    model.loadTexture("obj/african_head_diffuse.tga");
+    const struct { uint32_t width; uint32_t height; } jobs[] = { { 800, 800 }, { 1024, 768 }, { 800, 800 }, { 1024, 768 } };
+    const auto frames = 10;
+
+    auto pool = TGABufferPool();
+    for (auto pooled : { false, true })
+    {
+        TGAImage::set_buffer_pool(pooled ? &pool : nullptr);
+        const auto allocationsBefore = TGAImage::buffer_allocations();
+        auto steadyAllocations = 0ul;
+        const auto timer = TestUtils::Timer();
+        for (const auto& job : jobs)
+        {
+            auto renderer = ImageRenderer3D(job.width, job.height);
+            renderer.SetRasterMode(rasterMode);
+            for (auto frame = 0; frame < frames; frame++)
+            {
+                const auto allocationsAtFrame = TGAImage::buffer_allocations();
+                renderer.Clear(job.width, job.height);
+                renderer.DrawModel(model, Camera());
+                renderer.ExportImage("alloc_frame");
+                auto copy = renderer.GetImage();
+                copy.resample(job.width / 4, job.height / 4, TGAImage::BOX);
+                copy.write_tga_file("alloc_thumbnail.tga");
+                if (frame > 0)
+                    steadyAllocations += TGAImage::buffer_allocations() - allocationsAtFrame;
+            }
+        }
+        const auto totalFrames = frames * static_cast<int>(std::size(jobs));
+        spdlog::info("{:<9}: {} pixel buffers from the heap for {} frames, {:.2f} per frame after the first of a job, {:.2f} ms per frame",
+            pooled ? "pooled" : "no pool", TGAImage::buffer_allocations() - allocationsBefore, totalFrames,
+            static_cast<double>(steadyAllocations) / (totalFrames - std::size(jobs)),
+            timer.Seconds() * 1000. / totalFrames);
+    }
+    TGAImage::set_buffer_pool(nullptr);
+}
+
+// A frame sequence written frame by frame, exported on the render thread and through the export queue: the time per
+// frame, and how long the queue held the render loop back once it was full; test/ExportQueueTesting.cpp checks
+// the files and the error reports
+void exportQueueBenchmark()
+{
+    auto model = Model("obj/african_head.obj");
+    model.loadTexture("obj/african_head_diffuse.tga");
+    const auto frames = 30;
+    auto pool = TGABufferPool();
+    TGAImage::set_buffer_pool(&pool);
+
+    const auto render = [&](ImageRenderer3D& renderer, int frame)
+    {
+        auto camera = Camera();
+        camera.eye = Vec3f{ std::sin(frame * 0.1) * 5., 0., std::cos(frame * 0.1) * 5. };
+        renderer.Clear(width, height);
+        renderer.DrawModel(model, camera);
+    };
+    const auto frameName = [](const char* prefix, int frame) { return std::string(prefix) + std::to_string(frame % 4); };
+
+    auto renderer = ImageRenderer3D(width, height);
+    renderer.SetRasterMode(rasterMode);
+    auto timer = TestUtils::Timer();
+    for (auto frame = 0; frame < frames; frame++)
+        render(renderer, frame);
+    spdlog::info("not exported: {:.2f} ms per frame", timer.Seconds() * 1000. / frames);
+
+    timer.Reset();
+    auto written = 0;
+    for (auto frame = 0; frame < frames; frame++)
+    {
+        render(renderer, frame);
+        written += renderer.ExportImage(frameName("sync_frame", frame)) ? 1 : 0;
+    }
+    spdlog::info("exported on the render thread: {:.2f} ms per frame, {} of {} written", timer.Seconds() * 1000. / frames, written, frames);
+
+    for (auto threads : { 1, 2 })
+    {
+        auto queue = ExportQueue(threads, 4);
+        auto exported = std::vector<std::future<bool>>();
+        timer.Reset();
+        for (auto frame = 0; frame < frames; frame++)
+        {
+            render(renderer, frame);
+            exported.push_back(renderer.ExportImage(queue, frameName("async_frame", frame)));
+        }
+        const auto rendered = timer.Seconds();
+        queue.Flush();
+        written = static_cast<int>(std::count_if(exported.begin(), exported.end(), [](std::future<bool>& f) { return f.get(); }));
+        spdlog::info("export queue, {} writer threads: {:.2f} ms per frame rendered, {:.2f} ms with the last writes, held back {:.1f} ms, {} of {} written",
+            threads, rendered * 1000. / frames, timer.Seconds() * 1000. / frames, queue.WaitedSeconds() * 1000., written, frames);
+    }
+    TGAImage::set_buffer_pool(nullptr);
+}
+
+// the one entry point of the benchmarks: runs them all, or only the one named
+void benchmark(const std::string& name)
+{
+    const std::pair<const char*, void (*)()> benchmarks[] = {
+        { "alloc", allocBenchmark },
+        { "color_ops", colorOpsBenchmark },
+        { "dirty_region", dirtyRegionBenchmark },
+        { "export_queue", exportQueueBenchmark },
+        { "overdraw", overdrawBenchmark },
+        { "pipeline", pipelineBenchmark },
+        { "qoi", qoiBenchmark },
+        { "resample", resampleBenchmark },
+        { "span", spanBenchmark },
+        { "texture_layout", textureLayoutBenchmark },
+        { "transform", transformBenchmark },
+        { "tga_load", tgaLoadBenchmark },
+        { "tga_write", tgaWriteBenchmark },
+    };
+    auto ran = false;
+    for (const auto& b : benchmarks)
+    {
+        if (!name.empty() && name != b.first)
+            continue;
+        spdlog::info("{} benchmark", b.first);
+        b.second();
+        ran = true;
+    }
+    if (!ran)
+        spdlog::error("no benchmark called {}", name);
+}
 
 int main(int argc, char** argv)
 {
+    // TinyRenderer --benchmark [name] times the renderer and image code instead of drawing the head
+    if (argc > 1 && std::string(argv[1]) == "--benchmark")
+    {
+        benchmark(argc > 2 ? argv[2] : "");
+        return 0;
+    }
+
     //triangle_tests();
     //bmw();
     african_head();
     //transformationTests();
     //rendererTest();
+    //instancingTest();
 
     return 0;
 }
\ No newline at end of file
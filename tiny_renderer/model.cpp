@@ -3,11 +3,17 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include "model.h"
+#include "Simd.h"
+#include "Trace.h"
 
 using namespace MathLib;
 
 Model::Model(const char *filename) : verts_(), faces_() {
+    TR_TRACE_SCOPE("Model::Model");
     std::ifstream in;
     in.open(filename, std::ifstream::in);
     if (in.fail()) return;
@@ -58,29 +64,109 @@ Model::Model(const char *filename) : verts_(), faces_() {
             vn_.push_back(vn);
         }
     }
+    computeNormals();
     std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() << std::endl;
 }
 
+// Face normals (and smooth vertex normals when there are no vn) are computed once here in a batched pass:
+// the face edges are gathered as a structure of arrays so the cross products and normalizations run on two
+// faces per SSE2 register, renderers then only read them back.
+void Model::computeNormals() {
+    TR_TRACE_SCOPE("Model::computeNormals");
+    const auto nfaces = faces_.size();
+    auto ax = std::vector<double>(nfaces), ay = std::vector<double>(nfaces), az = std::vector<double>(nfaces);
+    auto bx = std::vector<double>(nfaces), by = std::vector<double>(nfaces), bz = std::vector<double>(nfaces);
+    for (size_t i = 0; i < nfaces; i++) {
+        if (faces_[i].size() < 3)
+            continue;
+        const auto& v0 = verts_[faces_[i][0][0]];
+        const auto& v1 = verts_[faces_[i][1][0]];
+        const auto& v2 = verts_[faces_[i][2][0]];
+        ax[i] = v1[0] - v0[0]; ay[i] = v1[1] - v0[1]; az[i] = v1[2] - v0[2];
+        bx[i] = v2[0] - v0[0]; by[i] = v2[1] - v0[1]; bz[i] = v2[2] - v0[2];
+    }
+
+    // unnormalized cross products, their length is twice the face area
+    auto nx = std::vector<double>(nfaces), ny = std::vector<double>(nfaces), nz = std::vector<double>(nfaces);
+    size_t i = 0;
+#if TR_SSE2
+    for (; i + 2 <= nfaces; i += 2) {
+        const auto eax = _mm_loadu_pd(&ax[i]), eay = _mm_loadu_pd(&ay[i]), eaz = _mm_loadu_pd(&az[i]);
+        const auto ebx = _mm_loadu_pd(&bx[i]), eby = _mm_loadu_pd(&by[i]), ebz = _mm_loadu_pd(&bz[i]);
+        _mm_storeu_pd(&nx[i], _mm_sub_pd(_mm_mul_pd(eay, ebz), _mm_mul_pd(eaz, eby)));
+        _mm_storeu_pd(&ny[i], _mm_sub_pd(_mm_mul_pd(eaz, ebx), _mm_mul_pd(eax, ebz)));
+        _mm_storeu_pd(&nz[i], _mm_sub_pd(_mm_mul_pd(eax, eby), _mm_mul_pd(eay, ebx)));
+    }
+#endif
+    for (; i < nfaces; i++) {
+        nx[i] = ay[i] * bz[i] - az[i] * by[i];
+        ny[i] = az[i] * bx[i] - ax[i] * bz[i];
+        nz[i] = ax[i] * by[i] - ay[i] * bx[i];
+    }
+
+    // area weighted average of the faces around each vertex
+    if (vn_.empty()) {
+        smoothNormals_.assign(verts_.size(), Vec3f{ 0., 0., 0. });
+        for (size_t f = 0; f < nfaces; f++) {
+            for (const auto& vertex : faces_[f]) {
+                auto& n = smoothNormals_[vertex[0]];
+                n[0] += nx[f];
+                n[1] += ny[f];
+                n[2] += nz[f];
+            }
+        }
+        for (auto& n : smoothNormals_) {
+            if (n.Dot(n) > 0.)
+                n.Normalize();
+        }
+    }
+
+    faceNormals_.resize(nfaces);
+    i = 0;
+#if TR_SSE2
+    const auto tiny = _mm_set1_pd(std::numeric_limits<double>::min());
+    for (; i + 2 <= nfaces; i += 2) {
+        const auto x = _mm_loadu_pd(&nx[i]), y = _mm_loadu_pd(&ny[i]), z = _mm_loadu_pd(&nz[i]);
+        const auto length = _mm_max_pd(_mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)), _mm_mul_pd(z, z))), tiny);
+        double out[3][2];
+        _mm_storeu_pd(out[0], _mm_div_pd(x, length));
+        _mm_storeu_pd(out[1], _mm_div_pd(y, length));
+        _mm_storeu_pd(out[2], _mm_div_pd(z, length));
+        faceNormals_[i] = Vec3f{ out[0][0], out[1][0], out[2][0] };
+        faceNormals_[i + 1] = Vec3f{ out[0][1], out[1][1], out[2][1] };
+    }
+#endif
+    for (; i < nfaces; i++) {
+        const auto length = std::max(std::sqrt(nx[i] * nx[i] + ny[i] * ny[i] + nz[i] * nz[i]), std::numeric_limits<double>::min());
+        faceNormals_[i] = Vec3f{ nx[i] / length, ny[i] / length, nz[i] / length };
+    }
+}
+
 Model::~Model() {
 }
 
-void Model::loadTexture(const char* filename)
+void Model::loadTexture(const char* filename, Texture::Layout layout)
 {
-    texture.read_tga_file(filename);
-    texture.flip_vertically();
+    TR_TRACE_SCOPE("Model::loadTexture");
+    // the texels are converted straight from the mapped file, the rows taken bottom up instead of flipping the image
+    auto image = TGAImage();
+    if (!image.map_tga_file(filename))
+        return;
+    // the whole mip chain is built once here, sampling never touches the TGAImage again
+    texture_ = Texture(image, layout, true);
 }
 
-int Model::nverts() {
+int Model::nverts() const {
     return (int)verts_.size();
 }
 
-int Model::nfaces() {
+int Model::nfaces() const {
     return (int)faces_.size();
 }
 
-std::vector<int> Model::face(int idx) {
+std::vector<int> Model::face(int idx) const {
     auto face = std::vector<int>();
-    for (auto i = 0; i < faces_.size(); i++)
+    for (size_t i = 0; i < faces_[idx].size(); i++)
     {
         face.push_back(faces_[idx][i][0]);
     }
@@ -89,16 +175,34 @@ std::vector<int> Model::face(int idx) {
 
 TGAColor Model::color(Vec2i uv)
 {
-    return texture.get(uv[0], uv[1]);
+    return texture_.Fetch(uv[0], uv[1]);
 }
 
-Vec2f Model::uv(int faceIdx, int nvert)
+Vec2f Model::uv(int faceIdx, int nvert) const
 {
     int faceVert = faces_[faceIdx][nvert][1];
-    return Vec2f{ vt_[faceVert][0] * texture.get_width(), vt_[faceVert][1] * texture.get_height() };
+    return Vec2f{ vt_[faceVert][0] * texture_.Width(), vt_[faceVert][1] * texture_.Height() };
+}
+
+const Texture& Model::texture() const
+{
+    return texture_;
+}
+
+// outward facing, (v1 - v0) x (v2 - v0)
+const Vec3f& Model::faceNormal(int faceIdx) const
+{
+    return faceNormals_[faceIdx];
+}
+
+const Vec3f& Model::normal(int faceIdx, int nvert) const
+{
+    if (!vn_.empty())
+        return vn_[faces_[faceIdx][nvert][2]];
+    return smoothNormals_[faces_[faceIdx][nvert][0]];
 }
 
-Vec3f Model::vert(int i) {
+Vec3f Model::vert(int i) const {
     return verts_[i];
 }
 
@@ -4,25 +4,33 @@
 #include <vector>
 #include <VecN.h>
 #include "tgaimage.h"
+#include "Texture.h"
 
 class Model {
 public:
     Model(const char *filename);
     ~Model();
-    int nverts();
-    int nfaces();
-    MathLib::Vec3f vert(int i);
-    std::vector<int> face(int idx);
-    void loadTexture(const char* filename);
+    int nverts() const;
+    int nfaces() const;
+    MathLib::Vec3f vert(int i) const;
+    std::vector<int> face(int idx) const;
+    void loadTexture(const char* filename, Texture::Layout layout = Texture::Layout::Linear);
     TGAColor color(MathLib::Vec2i uv);
-    MathLib::Vec2f Model::uv(int faceIdx, int nvert);
+    MathLib::Vec2f uv(int faceIdx, int nvert) const;
+    const Texture& texture() const;
+    const MathLib::Vec3f& faceNormal(int faceIdx) const;
+    const MathLib::Vec3f& normal(int faceIdx, int nvert) const;
 
 private:
+    void computeNormals();
+
     std::vector<MathLib::Vec3f> verts_;
     std::vector<std::vector<MathLib::Vec3i>> faces_;
     std::vector<MathLib::Vec3f> vn_;
     std::vector<MathLib::Vec2f> vt_;
-    TGAImage texture;
+    std::vector<MathLib::Vec3f> faceNormals_;
+    std::vector<MathLib::Vec3f> smoothNormals_; // per vertex, only when the file has no vn
+    Texture texture_;
 };
 
 #endif //__MODEL_H__
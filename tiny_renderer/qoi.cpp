@@ -0,0 +1,342 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string.h>
+#include "tgaimage.h"
+#include "MappedFile.h"
+#include "Trace.h"
+
+// QOI, the "Quite OK Image" format (https://qoiformat.org/qoi-specification.pdf): every pixel is a run of the
+// previous one, a reference into a hash index of the pixels seen so far, a small difference to the previous
+// pixel or a literal, so encoding and decoding are one pass with no entropy coder. The files are standard QOI,
+// pixels are packed r | g << 8 | b << 16 | a << 24 in between whatever the byte order of the TGAImage buffer.
+namespace {
+    const unsigned char QOI_OP_INDEX = 0x00; // 00xxxxxx
+    const unsigned char QOI_OP_DIFF = 0x40;  // 01xxxxxx
+    const unsigned char QOI_OP_LUMA = 0x80;  // 10xxxxxx
+    const unsigned char QOI_OP_RUN = 0xc0;   // 11xxxxxx
+    const unsigned char QOI_OP_RGB = 0xfe;
+    const unsigned char QOI_OP_RGBA = 0xff;
+    const unsigned char QOI_MASK_2 = 0xc0;
+    const int max_run = 62;
+    const unsigned long header_size = 14;
+    const unsigned char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    // like the reference implementation, so that a bad header can't ask for more than a few GB
+    const unsigned long max_pixels = 400000000;
+    const unsigned int start_pixel = 0xff000000; // opaque black
+    const unsigned long chunk_pixels = 1 << 16;
+
+    unsigned int hash(unsigned int px) {
+        return ((px & 0xff) * 3 + ((px >> 8) & 0xff) * 5 + ((px >> 16) & 0xff) * 7 + (px >> 24) * 11) & 63;
+    }
+
+    template <int bytespp> unsigned int load_pixel(const unsigned char *p);
+    template <> unsigned int load_pixel<1>(const unsigned char *p) { return p[0] | p[0] << 8 | p[0] << 16 | 0xff000000; }
+    template <> unsigned int load_pixel<3>(const unsigned char *p) { return p[2] | p[1] << 8 | p[0] << 16 | 0xff000000; }
+    template <> unsigned int load_pixel<4>(const unsigned char *p) { return p[2] | p[1] << 8 | p[0] << 16 | (unsigned int)p[3] << 24; }
+
+    template <int bytespp> void store_pixel(unsigned char *p, unsigned int px);
+    template <> void store_pixel<3>(unsigned char *p, unsigned int px) { p[0] = px >> 16; p[1] = px >> 8; p[2] = px; }
+    template <> void store_pixel<4>(unsigned char *p, unsigned int px) { p[0] = px >> 16; p[1] = px >> 8; p[2] = px; p[3] = px >> 24; }
+
+    // Encodes count pixels, carrying the index, the previous pixel and the pending run over from the pixels before,
+    // the last run is left pending. dst needs room for 5 bytes per pixel and one more, for the run the pixels before
+    // left pending.
+    template <int bytespp>
+    unsigned char *encode_pixels(const unsigned char *pixels, unsigned long count, unsigned int *index, unsigned int &previous, int &run, unsigned char *dst) {
+        for (unsigned long i = 0; i < count; i++, pixels += bytespp) {
+            const unsigned int px = load_pixel<bytespp>(pixels);
+            if (px == previous) {
+                if (++run == max_run) {
+                    *dst++ = QOI_OP_RUN | (max_run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                *dst++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            const unsigned int h = hash(px);
+            if (index[h] == px) {
+                *dst++ = QOI_OP_INDEX | h;
+            }
+            else {
+                index[h] = px;
+                if ((px >> 24) == (previous >> 24)) {
+                    const signed char vr = (signed char)((px & 0xff) - (previous & 0xff));
+                    const signed char vg = (signed char)(((px >> 8) & 0xff) - ((previous >> 8) & 0xff));
+                    const signed char vb = (signed char)(((px >> 16) & 0xff) - ((previous >> 16) & 0xff));
+                    const signed char vg_r = vr - vg;
+                    const signed char vg_b = vb - vg;
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        *dst++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                    }
+                    else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                        *dst++ = QOI_OP_LUMA | (vg + 32);
+                        *dst++ = (vg_r + 8) << 4 | (vg_b + 8);
+                    }
+                    else {
+                        *dst++ = QOI_OP_RGB;
+                        *dst++ = px;
+                        *dst++ = px >> 8;
+                        *dst++ = px >> 16;
+                    }
+                }
+                else {
+                    *dst++ = QOI_OP_RGBA;
+                    *dst++ = px;
+                    *dst++ = px >> 8;
+                    *dst++ = px >> 16;
+                    *dst++ = px >> 24;
+                }
+            }
+            previous = px;
+        }
+        return dst;
+    }
+
+    unsigned char *encode_pixels(const unsigned char *pixels, unsigned long count, int bytespp, unsigned int *index, unsigned int &previous, int &run, unsigned char *dst) {
+        switch (bytespp) {
+        case TGAImage::GRAYSCALE: return encode_pixels<1>(pixels, count, index, previous, run, dst);
+        case TGAImage::RGB: return encode_pixels<3>(pixels, count, index, previous, run, dst);
+        default: return encode_pixels<4>(pixels, count, index, previous, run, dst);
+        }
+    }
+
+    unsigned char *encode_header(int width, int height, int bytespp, unsigned char *dst) {
+        const unsigned char header[header_size] = { 'q', 'o', 'i', 'f',
+            (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+            (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+            // grayscale is stored as rgb, qoi has no single channel images
+            (unsigned char)(bytespp == TGAImage::RGBA ? 4 : 3),
+            0 }; // sRGB with linear alpha
+        memcpy(dst, header, header_size);
+        return dst + header_size;
+    }
+
+    unsigned char *encode_end(int run, unsigned char *dst) {
+        if (run > 0)
+            *dst++ = QOI_OP_RUN | (run - 1);
+        memcpy(dst, padding, sizeof(padding));
+        return dst + sizeof(padding);
+    }
+
+    // Decodes into a buffer of the right size, false when the chunks stop before the last pixel.
+    template <int bytespp>
+    bool decode_pixels(const unsigned char *in, const unsigned char *end, unsigned long npixels, unsigned char *out) {
+        unsigned int index[64];
+        memset(index, 0, sizeof(index));
+        unsigned int px = start_pixel;
+        int run = 0;
+        for (unsigned long i = 0; i < npixels; i++, out += bytespp) {
+            if (run > 0) {
+                run--;
+            }
+            else {
+                // the padding behind end leaves room for the longest chunk
+                if (in >= end) return false;
+                const unsigned char b1 = *in++;
+                if (QOI_OP_RGB == b1) {
+                    px = (px & 0xff000000) | in[0] | in[1] << 8 | in[2] << 16;
+                    in += 3;
+                }
+                else if (QOI_OP_RGBA == b1) {
+                    px = in[0] | in[1] << 8 | in[2] << 16 | (unsigned int)in[3] << 24;
+                    in += 4;
+                }
+                else if (QOI_OP_INDEX == (b1 & QOI_MASK_2)) {
+                    px = index[b1];
+                }
+                else if (QOI_OP_DIFF == (b1 & QOI_MASK_2)) {
+                    const unsigned char r = (px & 0xff) + ((b1 >> 4) & 0x03) - 2;
+                    const unsigned char g = ((px >> 8) & 0xff) + ((b1 >> 2) & 0x03) - 2;
+                    const unsigned char b = ((px >> 16) & 0xff) + (b1 & 0x03) - 2;
+                    px = (px & 0xff000000) | r | g << 8 | b << 16;
+                }
+                else if (QOI_OP_LUMA == (b1 & QOI_MASK_2)) {
+                    const unsigned char b2 = *in++;
+                    const int vg = (b1 & 0x3f) - 32;
+                    const unsigned char r = (px & 0xff) + vg - 8 + ((b2 >> 4) & 0x0f);
+                    const unsigned char g = ((px >> 8) & 0xff) + vg;
+                    const unsigned char b = ((px >> 16) & 0xff) + vg - 8 + (b2 & 0x0f);
+                    px = (px & 0xff000000) | r | g << 8 | b << 16;
+                }
+                else {
+                    run = b1 & 0x3f;
+                }
+                index[hash(px)] = px;
+            }
+            store_pixel<bytespp>(out, px);
+        }
+        return true;
+    }
+}
+
+bool TGAImage::encode_qoi(std::vector<unsigned char> &out) const {
+    TR_TRACE_SCOPE("TGAImage::encode_qoi");
+    if (!data) return false;
+    const unsigned long npixels = (unsigned long)width * height;
+    out.resize(header_size + npixels * 5 + 1 + sizeof(padding));
+    unsigned int index[64];
+    memset(index, 0, sizeof(index));
+    unsigned int previous = start_pixel;
+    int run = 0;
+    unsigned char *dst = encode_header(width, height, bytespp, out.data());
+    if (!bottom_up_rows)
+        dst = encode_pixels(data, npixels, bytespp, index, previous, run, dst);
+    else
+        for (int y = height - 1; y >= 0; y--)
+            dst = encode_pixels(row(y), width, bytespp, index, previous, run, dst);
+    dst = encode_end(run, dst);
+    out.resize(dst - out.data());
+    return true;
+}
+
+bool TGAImage::decode_qoi(const unsigned char *in, unsigned long size) {
+    TR_TRACE_SCOPE("TGAImage::decode_qoi");
+    release();
+    bottom_up_rows = false;
+    if (size < header_size + sizeof(padding) || memcmp(in, "qoif", 4) != 0) {
+        std::cerr << "not a qoi image\n";
+        return false;
+    }
+    const unsigned long w = (unsigned long)in[4] << 24 | in[5] << 16 | in[6] << 8 | in[7];
+    const unsigned long h = (unsigned long)in[8] << 24 | in[9] << 16 | in[10] << 8 | in[11];
+    const int channels = in[12];
+    if (w == 0 || h == 0 || h >= max_pixels / w || (channels != RGB && channels != RGBA)) {
+        std::cerr << "bad channels (or width/height) value\n";
+        return false;
+    }
+    width = w;
+    height = h;
+    bytespp = channels;
+    data = allocate((unsigned long)width * height * bytespp);
+    const unsigned char *end = in + size - sizeof(padding);
+    const bool decoded = RGBA == bytespp ? decode_pixels<4>(in + header_size, end, w * h, data) : decode_pixels<3>(in + header_size, end, w * h, data);
+    if (!decoded) {
+        release();
+        std::cerr << "an error occured while reading the data\n";
+        return false;
+    }
+    return true;
+}
+
+bool TGAImage::read_qoi_file(const char *filename) {
+    TR_TRACE_SCOPE("TGAImage::read_qoi_file");
+    release();
+    MappedFile file(filename);
+    if (!file.IsOpen()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    if (!decode_qoi(file.Data(), file.Size()))
+        return false;
+    std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
+    return true;
+}
+
+bool TGAImage::write_qoi_file(const char *filename) const {
+    TR_TRACE_SCOPE("TGAImage::write_qoi_file");
+    QOIWriter writer;
+    if (!writer.open(filename, width, height, bytespp))
+        return false;
+    if (!bottom_up_rows)
+        return writer.write_rows(data, height) && writer.close();
+    for (int y = height - 1; y >= 0; y--)
+        if (!writer.write_rows(row(y), 1))
+            return false;
+    return writer.close();
+}
+
+QOIWriter::QOIWriter() : width(0), height(0), bytespp(0), rows(0), previous(start_pixel), run(0) {
+    memset(index, 0, sizeof(index));
+}
+
+QOIWriter::~QOIWriter() {
+    if (out.is_open())
+        close();
+}
+
+bool QOIWriter::open(const char *filename, int w, int h, int bpp) {
+    TR_TRACE_SCOPE("QOIWriter::open");
+    if (out.is_open())
+        close();
+    if (w <= 0 || h <= 0 || (unsigned long)h >= max_pixels / w ||
+        (bpp != TGAImage::GRAYSCALE && bpp != TGAImage::RGB && bpp != TGAImage::RGBA)) {
+        std::cerr << "bad bpp (or width/height) value\n";
+        return false;
+    }
+    out.open(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    width = w;
+    height = h;
+    bytespp = bpp;
+    rows = 0;
+    memset(index, 0, sizeof(index));
+    previous = start_pixel;
+    run = 0;
+    unsigned char header[header_size];
+    encode_header(width, height, bytespp, header);
+    out.write((const char *)header, header_size);
+    if (!out.good()) {
+        std::cerr << "can't dump the qoi file\n";
+        out.close();
+        return false;
+    }
+    return true;
+}
+
+bool QOIWriter::write_rows(const unsigned char *pixels, int nrows) {
+    TR_TRACE_SCOPE("QOIWriter::write_rows");
+    if (!out.is_open() || nrows < 0 || rows + nrows > height) {
+        std::cerr << "can't write " << nrows << " more rows to a " << width << "x" << height << " qoi file with "
+            << rows << " rows written\n";
+        return false;
+    }
+    // a fixed buffer however big the band is, written out every chunk_pixels pixels
+    encoded.resize(chunk_pixels * 5 + 1);
+    const unsigned long npixels = (unsigned long)width * nrows;
+    for (unsigned long first = 0; first < npixels; first += chunk_pixels) {
+        const unsigned long count = npixels - first < chunk_pixels ? npixels - first : chunk_pixels;
+        const unsigned char *end = encode_pixels(pixels + first * bytespp, count, bytespp, index, previous, run, encoded.data());
+        out.write((const char *)encoded.data(), end - encoded.data());
+        if (!out.good()) {
+            std::cerr << "can't dump the qoi file\n";
+            return false;
+        }
+    }
+    rows += nrows;
+    return true;
+}
+
+bool QOIWriter::write_band(const TGAImage &band) {
+    if (band.get_width() != width || band.get_bytespp() != bytespp) {
+        std::cerr << "the band doesn't match the qoi file\n";
+        return false;
+    }
+    return write_rows(band.buffer(), band.get_height());
+}
+
+bool QOIWriter::close() {
+    if (!out.is_open()) return false;
+    const bool complete = rows == height;
+    if (!complete)
+        std::cerr << "only " << rows << " of the " << height << " rows were written\n";
+    unsigned char end[1 + sizeof(padding)];
+    const unsigned char *last = encode_end(run, end);
+    run = 0;
+    out.write((const char *)end, last - end);
+    const bool written = out.good();
+    if (!written)
+        std::cerr << "can't dump the qoi file\n";
+    out.close();
+    return complete && written;
+}
+
+int QOIWriter::rows_written() const {
+    return rows;
+}
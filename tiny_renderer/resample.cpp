@@ -0,0 +1,218 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <math.h>
+#include <string.h>
+#include "tgaimage.h"
+#include "Simd.h"
+#include "Trace.h"
+
+// Separable resampling: every output row is first filtered horizontally from its input row, then the output rows
+// are filtered vertically from the horizontal results. The weights of an output column (or row) are computed once.
+// Pixels are four floats in between, whatever bytespp is, so one pixel is one SSE register.
+namespace {
+    const double pi = 3.14159265358979323846;
+    // rows handed to a thread at a time
+    const int band_rows = 16;
+
+    double sinc(double x) {
+        if (x == 0.) return 1.;
+        x *= pi;
+        return sin(x) / x;
+    }
+
+    // (-0.5, 0.5] so the pixel at the end of the window, not the one before it, takes a center half way between two
+    double box(double x) {
+        return x > -0.5 && x <= 0.5 ? 1. : 0.;
+    }
+
+    double triangle(double x) {
+        x = fabs(x);
+        return x < 1. ? 1. - x : 0.;
+    }
+
+    double lanczos3(double x) {
+        return x > -3. && x < 3. ? sinc(x) * sinc(x / 3.) : 0.;
+    }
+
+    // which input pixels make an output pixel and how much, the weights sum to 1
+    struct Contributions {
+        std::vector<int> first;
+        std::vector<int> count;
+        std::vector<float> weights; // max_count per output pixel
+        int max_count;
+    };
+
+    // the filter is stretched by the scale when minifying, so every input pixel contributes
+    Contributions contributions(int in, int out, TGAImage::Filter filter) {
+        double (*kernel)(double) = TGAImage::BOX == filter ? box : TGAImage::BILINEAR == filter ? triangle : lanczos3;
+        const double radius = TGAImage::BOX == filter ? 0.5 : TGAImage::BILINEAR == filter ? 1. : 3.;
+        const double scale = (double)in / out;
+        const double stretch = scale > 1. ? scale : 1.;
+        const double support = radius * stretch;
+
+        Contributions c;
+        c.max_count = (int)ceil(support) * 2 + 1;
+        c.first.resize(out);
+        c.count.resize(out);
+        c.weights.assign((size_t)out * c.max_count, 0.f);
+        std::vector<double> w(c.max_count);
+        for (int i = 0; i < out; i++) {
+            const double center = (i + 0.5) * scale;
+            int first = (int)(center - support + 0.5);
+            int last = (int)(center + support + 0.5);
+            if (first < 0) first = 0;
+            if (last > in) last = in;
+            if (last - first > c.max_count) last = first + c.max_count;
+            double sum = 0.;
+            for (int j = first; j < last; j++) {
+                w[j - first] = kernel((j - center + 0.5) / stretch);
+                sum += w[j - first];
+            }
+            // a window clipped at the image border with no weight left, the nearest pixel then
+            if (sum == 0.) {
+                first = (int)center < in ? (int)center : in - 1;
+                last = first + 1;
+                w[0] = sum = 1.;
+            }
+            c.first[i] = first;
+            c.count[i] = last - first;
+            for (int j = 0; j < last - first; j++)
+                c.weights[(size_t)i * c.max_count + j] = (float)(w[j] / sum);
+        }
+        return c;
+    }
+
+    void to_floats(const unsigned char *src, int width, int bytespp, float *dst) {
+        for (int x = 0; x < width; x++, src += bytespp, dst += 4) {
+            dst[0] = src[0];
+            dst[1] = bytespp > 1 ? src[1] : 0.f;
+            dst[2] = bytespp > 2 ? src[2] : 0.f;
+            dst[3] = bytespp > 3 ? src[3] : 0.f;
+        }
+    }
+
+    // rounded and clamped to [0, 255], the negative lobes of Lanczos overshoot
+    void to_bytes(const float *src, int width, int bytespp, unsigned char *dst) {
+        int x = 0;
+#if TR_SSE2
+        // four pixels packed to 16 bytes, stored as they are for rgba, a pixel at a time otherwise
+        for (; x + 4 <= width; x += 4) {
+            const __m128i p01 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_loadu_ps(src + x * 4)), _mm_cvtps_epi32(_mm_loadu_ps(src + x * 4 + 4)));
+            const __m128i p23 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_loadu_ps(src + x * 4 + 8)), _mm_cvtps_epi32(_mm_loadu_ps(src + x * 4 + 12)));
+            const __m128i packed = _mm_packus_epi16(p01, p23);
+            if (TGAImage::RGBA == bytespp) {
+                _mm_storeu_si128((__m128i *)(dst + x * 4), packed);
+                continue;
+            }
+            unsigned char pixels[16];
+            _mm_storeu_si128((__m128i *)pixels, packed);
+            for (int k = 0; k < 4; k++)
+                memcpy(dst + (x + k) * bytespp, pixels + k * 4, bytespp);
+        }
+#endif
+        for (; x < width; x++) {
+            for (int k = 0; k < bytespp; k++) {
+                const long v = lrintf(src[x * 4 + k]); // to nearest even, like _mm_cvtps_epi32
+                dst[x * bytespp + k] = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+            }
+        }
+    }
+
+    // out[i] = sum of the weighted input pixels, a pixel at a time
+    void filter_row(const float *in, const Contributions &c, int width, float *out) {
+        for (int i = 0; i < width; i++, out += 4) {
+            const float *w = &c.weights[(size_t)i * c.max_count];
+            const float *p = in + (size_t)c.first[i] * 4;
+#if TR_SSE2
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < c.count[i]; k++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(p + k * 4), _mm_set1_ps(w[k])));
+            _mm_storeu_ps(out, sum);
+#else
+            out[0] = out[1] = out[2] = out[3] = 0.f;
+            for (int k = 0; k < c.count[i]; k++)
+                for (int j = 0; j < 4; j++)
+                    out[j] += p[k * 4 + j] * w[k];
+#endif
+        }
+    }
+
+    // out = sum of the weighted rows, four floats at a time along the rows
+    void filter_column(const float *rows, size_t row_floats, int first, int count, const float *w, float *out) {
+        size_t i = 0;
+#if TR_SSE2
+        for (; i + 4 <= row_floats; i += 4) {
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < count; k++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows + (first + k) * row_floats + i), _mm_set1_ps(w[k])));
+            _mm_storeu_ps(out + i, sum);
+        }
+#endif
+        for (; i < row_floats; i++) {
+            float sum = 0.f;
+            for (int k = 0; k < count; k++)
+                sum += rows[(first + k) * row_floats + i] * w[k];
+            out[i] = sum;
+        }
+    }
+
+    // runs work(first, last) on bands of rows from an atomic counter, on the calling thread and nthreads - 1 more
+    void for_bands(int rows, int nthreads, const std::function<void(int, int)> &work) {
+        std::atomic<int> next(0);
+        const auto run = [&]() {
+            for (int first = next.fetch_add(band_rows); first < rows; first = next.fetch_add(band_rows))
+                work(first, first + band_rows < rows ? first + band_rows : rows);
+        };
+        std::vector<std::thread> workers;
+        for (int t = 1; t < nthreads; t++)
+            workers.emplace_back(run);
+        run();
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+    }
+}
+
+bool TGAImage::resample(int w, int h, Filter filter, int nthreads) {
+    TR_TRACE_SCOPE("TGAImage::resample");
+    if (w <= 0 || h <= 0 || !data) return false;
+    if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+    if (nthreads <= 0) nthreads = 1;
+
+    const Contributions columns = contributions(width, w, filter);
+    const Contributions rows = contributions(height, h, filter);
+
+    // only the input rows some output row needs are filtered horizontally
+    const size_t row_floats = (size_t)w * 4;
+    // left uninitialized, the rows no output row needs are never read
+    std::unique_ptr<float[]> horizontal(new float[(size_t)height * row_floats]);
+    std::vector<char> needed(height, 0);
+    for (int y = 0; y < h; y++)
+        memset(&needed[rows.first[y]], 1, rows.count[y]);
+    for_bands(height, nthreads, [&](int first, int last) {
+        std::vector<float> line((size_t)width * 4);
+        for (int y = first; y < last; y++) {
+            if (!needed[y]) continue;
+            to_floats(data + (unsigned long)y * width * bytespp, width, bytespp, line.data());
+            filter_row(line.data(), columns, w, horizontal.get() + y * row_floats);
+        }
+    });
+
+    unsigned char *tdata = allocate((unsigned long)w * h * bytespp);
+    for_bands(h, nthreads, [&](int first, int last) {
+        std::vector<float> line(row_floats);
+        for (int y = first; y < last; y++) {
+            filter_column(horizontal.get(), row_floats, rows.first[y], rows.count[y], &rows.weights[(size_t)y * rows.max_count], line.data());
+            to_bytes(line.data(), w, bytespp, tdata + (unsigned long)y * w * bytespp);
+        }
+    });
+
+    release();
+    data = tdata;
+    width = w;
+    height = h;
+    return true;
+}
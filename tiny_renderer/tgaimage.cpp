@@ -1,48 +1,178 @@
 #include <iostream>
 #include <fstream>
+#include <new>
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <atomic>
+#include <thread>
+#include <vector>
 #include "tgaimage.h"
+#include "MappedFile.h"
+#include "Simd.h"
+#include "Trace.h"
 
-TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
+namespace {
+    const std::size_t buffer_alignment = 64; // a cache line, and enough for any SSE or AVX load
+
+    std::atomic<TGABufferPool *> buffer_pool(NULL);
+    std::atomic<unsigned long> heap_allocations(0);
+
+    unsigned char *aligned_new(unsigned long nbytes) {
+        return static_cast<unsigned char *>(::operator new(nbytes, std::align_val_t(buffer_alignment)));
+    }
+
+    void aligned_delete(unsigned char *buffer) {
+        ::operator delete(buffer, std::align_val_t(buffer_alignment));
+    }
+}
+
+TGABufferPool::TGABufferPool(unsigned long max_bytes) : max_bytes(max_bytes), held(0) {
+    buffers.reserve(64);
+}
+
+TGABufferPool::~TGABufferPool() {
+    for (size_t i = 0; i < buffers.size(); i++)
+        aligned_delete(buffers[i].data);
+}
+
+unsigned char *TGABufferPool::acquire(unsigned long nbytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (buffers[i].nbytes != nbytes) continue;
+        unsigned char *buffer = buffers[i].data;
+        buffers[i] = buffers.back();
+        buffers.pop_back();
+        held -= nbytes;
+        return buffer;
+    }
+    return NULL;
+}
+
+bool TGABufferPool::give_back(unsigned char *buffer, unsigned long nbytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (held + nbytes > max_bytes || buffers.size() == buffers.capacity()) return false;
+    Buffer b = { buffer, nbytes };
+    buffers.push_back(b);
+    held += nbytes;
+    return true;
+}
+
+unsigned long TGABufferPool::held_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return held;
+}
+
+unsigned char *TGAImage::allocate(unsigned long nbytes) {
+    TGABufferPool *pool = buffer_pool.load();
+    unsigned char *buffer = pool ? pool->acquire(nbytes) : NULL;
+    if (buffer) return buffer;
+    heap_allocations++;
+    return aligned_new(nbytes);
+}
+
+void TGAImage::deallocate(unsigned char *buffer, unsigned long nbytes) {
+    TGABufferPool *pool = buffer_pool.load();
+    if (!pool || !pool->give_back(buffer, nbytes))
+        aligned_delete(buffer);
+}
+
+void TGAImage::set_buffer_pool(TGABufferPool *pool) {
+    buffer_pool = pool;
+}
+
+unsigned long TGAImage::buffer_allocations() {
+    return heap_allocations;
+}
+
+TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0), mapping(NULL), bottom_up_rows(false) {
 }
 
-TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
-    unsigned long nbytes = width * height*bytespp;
-    data = new unsigned char[nbytes];
+TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp), mapping(NULL), bottom_up_rows(false) {
+    unsigned long nbytes = (unsigned long)width * height*bytespp;
+    data = allocate(nbytes);
     memset(data, 0, nbytes);
 }
 
-TGAImage::TGAImage(const TGAImage &img) {
+TGAImage::TGAImage(const TGAImage &img) : mapping(NULL) {
     width = img.width;
     height = img.height;
     bytespp = img.bytespp;
-    unsigned long nbytes = width * height*bytespp;
-    data = new unsigned char[nbytes];
+    bottom_up_rows = img.bottom_up_rows;
+    unsigned long nbytes = (unsigned long)width * height*bytespp;
+    data = allocate(nbytes);
     memcpy(data, img.data, nbytes);
 }
 
+TGAImage::TGAImage(TGAImage &&img) noexcept : data(img.data), width(img.width), height(img.height), bytespp(img.bytespp),
+    mapping(img.mapping), bottom_up_rows(img.bottom_up_rows) {
+    img.data = NULL;
+    img.mapping = NULL;
+    img.width = img.height = 0;
+}
+
 TGAImage::~TGAImage() {
-    if (data) delete[] data;
+    release();
+}
+
+void TGAImage::release() {
+    if (mapping) delete mapping;
+    else if (data) deallocate(data, (unsigned long)width * height*bytespp);
+    mapping = NULL;
+    data = NULL;
+}
+
+// a view becomes an ordinary image with its own pixels, the mapping is closed
+void TGAImage::detach() {
+    if (!mapping) return;
+    unsigned long nbytes = (unsigned long)width * height*bytespp;
+    unsigned char *copy = allocate(nbytes);
+    memcpy(copy, data, nbytes);
+    delete mapping;
+    mapping = NULL;
+    data = copy;
+}
+
+bool TGAImage::is_view() const {
+    return mapping != NULL;
 }
 
 TGAImage & TGAImage::operator =(const TGAImage &img) {
     if (this != &img) {
-        if (data) delete[] data;
+        unsigned long nbytes = (unsigned long)img.width * img.height*img.bytespp;
+        if (mapping || !data || nbytes != (unsigned long)width * height*bytespp) {
+            release();
+            data = allocate(nbytes);
+        }
         width = img.width;
         height = img.height;
         bytespp = img.bytespp;
-        unsigned long nbytes = width * height*bytespp;
-        data = new unsigned char[nbytes];
+        bottom_up_rows = img.bottom_up_rows;
         memcpy(data, img.data, nbytes);
     }
     return *this;
 }
 
+TGAImage & TGAImage::operator =(TGAImage &&img) noexcept {
+    if (this != &img) {
+        release();
+        data = img.data;
+        width = img.width;
+        height = img.height;
+        bytespp = img.bytespp;
+        mapping = img.mapping;
+        bottom_up_rows = img.bottom_up_rows;
+        img.data = NULL;
+        img.mapping = NULL;
+        img.width = img.height = 0;
+    }
+    return *this;
+}
+
 bool TGAImage::read_tga_file(const char *filename) {
-    if (data) delete[] data;
-    data = NULL;
+    TR_TRACE_SCOPE("TGAImage::read_tga_file");
+    release();
+    bottom_up_rows = false;
     std::ifstream in;
     in.open(filename, std::ios::binary);
     if (!in.is_open()) {
@@ -65,8 +195,8 @@ bool TGAImage::read_tga_file(const char *filename) {
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
-    unsigned long nbytes = bytespp * width*height;
-    data = new unsigned char[nbytes];
+    unsigned long nbytes = (unsigned long)bytespp * width*height;
+    data = allocate(nbytes);
     if (3 == header.datatypecode || 2 == header.datatypecode) {
         in.read((char *)data, nbytes);
         if (!in.good()) {
@@ -99,7 +229,7 @@ bool TGAImage::read_tga_file(const char *filename) {
 }
 
 bool TGAImage::load_rle_data(std::ifstream &in) {
-    unsigned long pixelcount = width * height;
+    unsigned long pixelcount = (unsigned long)width * height;
     unsigned long currentpixel = 0;
     unsigned long currentbyte = 0;
     TGAColor colorbuffer;
@@ -148,10 +278,179 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
     return true;
 }
 
-bool TGAImage::write_tga_file(const char *filename, bool rle) {
-    unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
-    unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
-    unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
+bool TGAImage::map_tga_file(const char *filename) {
+    TR_TRACE_SCOPE("TGAImage::map_tga_file");
+    release();
+    bottom_up_rows = false;
+    MappedFile *file = new MappedFile(filename);
+    if (!file->IsOpen()) {
+        delete file;
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    const unsigned char *begin = file->Data();
+    const unsigned char *end = begin + file->Size();
+    TGA_Header header;
+    if (file->Size() < sizeof(header)) {
+        delete file;
+        std::cerr << "an error occured while reading the header\n";
+        return false;
+    }
+    memcpy(&header, begin, sizeof(header));
+    width = header.width;
+    height = header.height;
+    bytespp = header.bitsperpixel >> 3;
+    if (width <= 0 || height <= 0 || (bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA)) {
+        delete file;
+        std::cerr << "bad bpp (or width/height) value\n";
+        return false;
+    }
+    const unsigned char *pixels = begin + sizeof(header) + (unsigned char)header.idlength;
+    const bool bottom_up = !(header.imagedescriptor & 0x20);
+    const bool right_to_left = (header.imagedescriptor & 0x10) != 0;
+    unsigned long nbytes = (unsigned long)bytespp * width*height;
+    if (3 == header.datatypecode || 2 == header.datatypecode) {
+        if (pixels > end || (unsigned long)(end - pixels) < nbytes) {
+            delete file;
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+        if (!bottom_up && !right_to_left) {
+            // the file already holds the image the way it is kept in memory
+            mapping = file;
+            data = const_cast<unsigned char *>(pixels);
+            return true;
+        }
+        data = allocate(nbytes);
+        unsigned long bytes_per_line = width * bytespp;
+        for (int j = 0; j < height; j++) {
+            memcpy(data + (bottom_up ? height - 1 - j : j)*bytes_per_line, pixels + j * bytes_per_line, bytes_per_line);
+        }
+    }
+    else if (10 == header.datatypecode || 11 == header.datatypecode) {
+        data = allocate(nbytes);
+        if (pixels > end || !load_rle_data(pixels, end, bottom_up)) {
+            delete file;
+            release();
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+    }
+    else {
+        delete file;
+        std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
+        return false;
+    }
+    delete file;
+    if (right_to_left) {
+        flip_horizontally();
+    }
+    return true;
+}
+
+// Decodes from memory with plain pointer reads, every pixel goes straight to its row of the top-down image
+// so a bottom-up file needs no flip afterwards. Chunks can span rows, they are copied a row part at a time.
+bool TGAImage::load_rle_data(const unsigned char *in, const unsigned char *end, bool bottom_up) {
+    const unsigned long bytes_per_line = width * bytespp;
+    unsigned long remaining = (unsigned long)width * height;
+    int x = 0;
+    int y = 0;
+    unsigned char *line = data + (bottom_up ? height - 1 : 0)*bytes_per_line;
+    while (remaining > 0) {
+        if (in >= end) {
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+        const unsigned char chunkheader = *in++;
+        const bool run = chunkheader >= 128;
+        unsigned long count = run ? chunkheader - 127 : chunkheader + 1;
+        if (count > remaining) {
+            std::cerr << "Too many pixels read\n";
+            return false;
+        }
+        if ((unsigned long)(end - in) < (run ? 1 : count) * bytespp) {
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+        remaining -= count;
+        while (count > 0) {
+            const unsigned long n = count < (unsigned long)(width - x) ? count : width - x;
+            unsigned char *dst = line + x * bytespp;
+            if (run) {
+                // the repeated pixel is doubled up until the part is filled, a few copies instead of one per pixel
+                const unsigned long total = n * bytespp;
+                unsigned long filled = bytespp;
+                memcpy(dst, in, bytespp);
+                while (filled < total) {
+                    const unsigned long chunk = filled < total - filled ? filled : total - filled;
+                    memcpy(dst + filled, dst, chunk);
+                    filled += chunk;
+                }
+            }
+            else {
+                memcpy(dst, in, n*bytespp);
+                in += n * bytespp;
+            }
+            x += n;
+            count -= n;
+            if (x == width && ++y < height) {
+                x = 0;
+                line = data + (bottom_up ? height - 1 - y : y)*bytes_per_line;
+            }
+        }
+        if (run) in += bytespp;
+    }
+    return true;
+}
+
+namespace {
+    bool write_header(std::ofstream &out, int width, int height, int bytespp, bool rle, bool bottom_up) {
+        TGA_Header header;
+        memset((void *)&header, 0, sizeof(header));
+        header.bitsperpixel = bytespp << 3;
+        header.width = width;
+        header.height = height;
+        header.datatypecode = (bytespp == TGAImage::GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
+        header.imagedescriptor = bottom_up ? 0x00 : 0x20; // bottom-left or top-left origin
+        out.write((char *)&header, sizeof(header));
+        if (!out.good()) {
+            std::cerr << "can't dump the tga file\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool write_footer(std::ofstream &out) {
+        unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
+        unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
+        unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
+        out.write((char *)developer_area_ref, sizeof(developer_area_ref));
+        if (!out.good()) {
+            std::cerr << "can't dump the tga file\n";
+            return false;
+        }
+        out.write((char *)extension_area_ref, sizeof(extension_area_ref));
+        if (!out.good()) {
+            std::cerr << "can't dump the tga file\n";
+            return false;
+        }
+        out.write((char *)footer, sizeof(footer));
+        if (!out.good()) {
+            std::cerr << "can't dump the tga file\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool write_rle(std::ofstream &out, const unsigned char *data, int bytespp, int width, int height, int nthreads);
+}
+
+bool TGAImage::write_tga_file(const char *filename, bool rle, int nthreads) {
+    TR_TRACE_SCOPE("TGAImage::write_tga_file");
+    if (width > max_dimension || height > max_dimension) {
+        std::cerr << "a tga image can't be larger than " << max_dimension << " pixels\n";
+        return false;
+    }
     std::ofstream out;
     out.open(filename, std::ios::binary);
     if (!out.is_open()) {
@@ -159,21 +458,12 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
         out.close();
         return false;
     }
-    TGA_Header header;
-    memset((void *)&header, 0, sizeof(header));
-    header.bitsperpixel = bytespp << 3;
-    header.width = width;
-    header.height = height;
-    header.datatypecode = (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
-    header.imagedescriptor = 0x20; // top-left origin
-    out.write((char *)&header, sizeof(header));
-    if (!out.good()) {
+    if (!write_header(out, width, height, bytespp, rle, bottom_up_rows)) {
         out.close();
-        std::cerr << "can't dump the tga file\n";
         return false;
     }
     if (!rle) {
-        out.write((char *)data, width*height*bytespp);
+        out.write((char *)data, (unsigned long)width*height*bytespp);
         if (!out.good()) {
             std::cerr << "can't unload raw data\n";
             out.close();
@@ -181,27 +471,13 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
         }
     }
     else {
-        if (!unload_rle_data(out)) {
+        if (!unload_rle_data(out, nthreads)) {
             out.close();
             std::cerr << "can't unload rle data\n";
             return false;
         }
     }
-    out.write((char *)developer_area_ref, sizeof(developer_area_ref));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
-        return false;
-    }
-    out.write((char *)extension_area_ref, sizeof(extension_area_ref));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
-        return false;
-    }
-    out.write((char *)footer, sizeof(footer));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
+    if (!write_footer(out)) {
         out.close();
         return false;
     }
@@ -209,49 +485,212 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
     return true;
 }
 
+// Chunks follow exactly the rules of the original byte by byte encoder, so one band encodes to the same bytes:
+// a run takes up to 128 equal pixels, a raw chunk stops before the first pair of equal pixels or at 128 pixels.
 // TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
-    const unsigned char max_chunk_length = 128;
-    unsigned long npixels = width * height;
-    unsigned long curpix = 0;
-    while (curpix < npixels) {
-        unsigned long chunkstart = curpix * bytespp;
-        unsigned long curbyte = curpix * bytespp;
-        unsigned char run_length = 1;
-        bool raw = true;
-        while (curpix + run_length < npixels && run_length < max_chunk_length) {
-            bool succ_eq = true;
-            for (int t = 0; succ_eq && t < bytespp; t++) {
-                succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
+namespace {
+    const unsigned long max_chunk_length = 128;
+    // big images are cut in bands of about that many pixels, encoded in parallel
+    const unsigned long band_pixels = 1 << 20;
+
+    unsigned lowest_bit(unsigned mask) {
+        unsigned bit = 0;
+        while (!(mask & 1)) {
+            mask >>= 1;
+            bit++;
+        }
+        return bit;
+    }
+
+    // First pixel k in [from, to) for which the pair k, k + 1 is equal (or unequal), to if there is none.
+    // SSE2 compares a block of 16 bytes against the same bytes one pixel further, a pair is equal when all its bytes are.
+    unsigned long find_pair(const unsigned char *data, int bytespp, unsigned long npixels, unsigned long from, unsigned long to, bool equal) {
+        unsigned long k = from;
+#if TR_SSE2
+        const unsigned long per_block = 16 / bytespp;
+        while (k + per_block <= to && (k + 1) * bytespp + 16 <= npixels * bytespp) {
+            const __m128i a = _mm_loadu_si128((const __m128i *)(data + k * bytespp));
+            const __m128i b = _mm_loadu_si128((const __m128i *)(data + (k + 1) * bytespp));
+            const unsigned bytes = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+            unsigned pairs = 0;
+            if (1 == bytespp) {
+                pairs = bytes;
             }
-            curbyte += bytespp;
-            if (1 == run_length) {
-                raw = !succ_eq;
+            else {
+                unsigned all = bytes;
+                for (int t = 1; t < bytespp; t++)
+                    all &= bytes >> t;
+                for (unsigned long j = 0; j < per_block; j++)
+                    pairs |= ((all >> (j * bytespp)) & 1) << j;
             }
-            if (raw && succ_eq) {
-                run_length--;
-                break;
+            if (!equal)
+                pairs = ~pairs & ((1u << per_block) - 1);
+            if (pairs)
+                return k + lowest_bit(pairs);
+            k += per_block;
+        }
+#endif
+        for (; k < to; k++) {
+            if ((memcmp(data + k * bytespp, data + (k + 1) * bytespp, bytespp) == 0) == equal)
+                return k;
+        }
+        return to;
+    }
+
+    // encodes pixels [first, last) into out, which is sized for the worst case and trimmed at the end
+    void encode_rle_band(const unsigned char *data, int bytespp, unsigned long npixels, unsigned long first, unsigned long last, std::vector<unsigned char> &out) {
+        const unsigned long count = last - first;
+        // a header per pixel is more than the worst case, one lone raw pixel before every run of two
+        out.resize(count * (bytespp + 1));
+        unsigned char *dst = out.data();
+        unsigned long p = first;
+        while (p < last) {
+            const unsigned long limit = (p + max_chunk_length - 1 < last - 1) ? p + max_chunk_length - 1 : last - 1;
+            if (p + 1 < last && memcmp(data + p * bytespp, data + (p + 1) * bytespp, bytespp) == 0) {
+                const unsigned long length = find_pair(data, bytespp, npixels, p, limit, false) - p + 1;
+                *dst++ = (unsigned char)(length + 127);
+                memcpy(dst, data + p * bytespp, bytespp);
+                dst += bytespp;
+                p += length;
             }
-            if (!raw && !succ_eq) {
-                break;
+            else {
+                const unsigned long equal = find_pair(data, bytespp, npixels, p + 1, limit, true);
+                unsigned long length = equal < limit ? equal - p : last - p;
+                if (length > max_chunk_length)
+                    length = max_chunk_length;
+                *dst++ = (unsigned char)(length - 1);
+                memcpy(dst, data + p * bytespp, length * bytespp);
+                dst += length * bytespp;
+                p += length;
             }
-            run_length++;
         }
-        curpix += run_length;
-        out.put(raw ? run_length - 1 : run_length + 127);
-        if (!out.good()) {
-            std::cerr << "can't dump the tga file\n";
+        out.resize(dst - out.data());
+    }
+
+    // The pixels are encoded in memory and written with one call per band. Bands are whole rows, independent from
+    // each other, and their height only depends on the width, so the output is the same whatever the thread count.
+    bool write_rle(std::ofstream &out, const unsigned char *data, int bytespp, int width, int height, int nthreads) {
+        const unsigned long npixels = (unsigned long)width * height;
+        unsigned long band_rows = band_pixels / width;
+        if (band_rows < 1) band_rows = 1;
+        const unsigned long nbands = npixels <= band_pixels ? 1 : (height + band_rows - 1) / band_rows;
+        if (1 == nbands) band_rows = height;
+
+        std::vector<std::vector<unsigned char> > bands(nbands);
+        std::atomic<unsigned long> next(0);
+        const auto encode = [&]() {
+            for (unsigned long band = next++; band < nbands; band = next++) {
+                const unsigned long first = band * band_rows * width;
+                const unsigned long last = (band + 1) * band_rows >= (unsigned long)height ? npixels : (band + 1) * band_rows * width;
+                encode_rle_band(data, bytespp, npixels, first, last, bands[band]);
+            }
+        };
+        if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+        if (nthreads <= 0) nthreads = 1;
+        if ((unsigned long)nthreads > nbands) nthreads = (int)nbands;
+        std::vector<std::thread> workers;
+        for (int t = 1; t < nthreads; t++)
+            workers.emplace_back(encode);
+        encode();
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+
+        for (size_t band = 0; band < bands.size(); band++) {
+            out.write((const char *)bands[band].data(), bands[band].size());
+            if (!out.good()) {
+                std::cerr << "can't dump the tga file\n";
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+bool TGAImage::unload_rle_data(std::ofstream &out, int nthreads) {
+    return write_rle(out, data, bytespp, width, height, nthreads);
+}
+
+TGAWriter::TGAWriter() : width(0), height(0), bytespp(0), rle(true), rows(0), nthreads(0) {
+}
+
+TGAWriter::~TGAWriter() {
+    if (out.is_open())
+        close();
+}
+
+bool TGAWriter::open(const char *filename, int w, int h, int bpp, bool rle_, bool bottom_up, int nthreads_) {
+    TR_TRACE_SCOPE("TGAWriter::open");
+    if (out.is_open())
+        close();
+    if (w <= 0 || h <= 0 || w > TGAImage::max_dimension || h > TGAImage::max_dimension ||
+        (bpp != TGAImage::GRAYSCALE && bpp != TGAImage::RGB && bpp != TGAImage::RGBA)) {
+        std::cerr << "bad bpp (or width/height) value\n";
+        return false;
+    }
+    out.open(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    width = w;
+    height = h;
+    bytespp = bpp;
+    rle = rle_;
+    nthreads = nthreads_;
+    rows = 0;
+    if (!write_header(out, width, height, bytespp, rle, bottom_up)) {
+        out.close();
+        return false;
+    }
+    return true;
+}
+
+bool TGAWriter::write_rows(const unsigned char *pixels, int nrows) {
+    TR_TRACE_SCOPE("TGAWriter::write_rows");
+    if (!out.is_open() || nrows < 0 || rows + nrows > height) {
+        std::cerr << "can't write " << nrows << " more rows to a " << width << "x" << height << " tga file with "
+            << rows << " rows written\n";
+        return false;
+    }
+    if (rle) {
+        if (!write_rle(out, pixels, bytespp, width, nrows, nthreads)) {
+            std::cerr << "can't unload rle data\n";
             return false;
         }
-        out.write((char *)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
+    }
+    else {
+        out.write((const char *)pixels, (unsigned long)width*nrows*bytespp);
         if (!out.good()) {
-            std::cerr << "can't dump the tga file\n";
+            std::cerr << "can't unload raw data\n";
             return false;
         }
     }
+    rows += nrows;
     return true;
 }
 
+bool TGAWriter::write_band(const TGAImage &band) {
+    if (band.get_width() != width || band.get_bytespp() != bytespp) {
+        std::cerr << "the band doesn't match the tga file\n";
+        return false;
+    }
+    return write_rows(band.buffer(), band.get_height());
+}
+
+bool TGAWriter::close() {
+    if (!out.is_open()) return false;
+    const bool complete = rows == height;
+    if (!complete)
+        std::cerr << "only " << rows << " of the " << height << " rows were written\n";
+    const bool written = write_footer(out);
+    out.close();
+    return complete && written;
+}
+
+int TGAWriter::rows_written() const {
+    return rows;
+}
+
 TGAColor TGAImage::get(int x, int y) {
     if (!data || x < 0 || y < 0 || x >= width || y >= height) {
         return TGAColor();
@@ -259,35 +698,218 @@ TGAColor TGAImage::get(int x, int y) {
     return TGAColor(data + (x + y * width)*bytespp, bytespp);
 }
 
-bool TGAImage::set(int x, int y, TGAColor c) {
+bool TGAImage::set(int x, int y, const TGAColor &c) {
     if (!data || x < 0 || y < 0 || x >= width || y >= height) {
         return false;
     }
+    detach();
     memcpy(data + (x + y * width)*bytespp, c.raw, bytespp);
     return true;
 }
 
-int TGAImage::get_bytespp() {
+unsigned char *TGAImage::row(int y) {
+    detach();
+    return data + (unsigned long)y * width * bytespp;
+}
+
+const unsigned char *TGAImage::row(int y) const {
+    return data + (unsigned long)y * width * bytespp;
+}
+
+namespace {
+    // the part of [x, x + length) inside [0, width), false when nothing is left
+    bool clip_span(int &x, int &length, int width) {
+        if (x < 0) {
+            length += x;
+            x = 0;
+        }
+        if (length > width - x)
+            length = width - x;
+        return length > 0;
+    }
+}
+
+bool TGAImage::fill_span(int x, int y, int length, const TGAColor &c) {
+    if (!data || y < 0 || y >= height || !clip_span(x, length, width)) {
+        return false;
+    }
+    unsigned char *dst = row(y) + x * bytespp;
+    if (1 == bytespp) {
+        memset(dst, c.raw[0], length);
+        return true;
+    }
+    // one pixel, then the filled part copied onto the rest, doubling every time
+    memcpy(dst, c.raw, bytespp);
+    const unsigned long total = (unsigned long)length * bytespp;
+    for (unsigned long filled = bytespp; filled < total; filled <<= 1)
+        memcpy(dst + filled, dst, filled < total - filled ? filled : total - filled);
+    return true;
+}
+
+bool TGAImage::copy_span(int x, int y, int length, const unsigned char *pixels) {
+    const int first = x;
+    if (!data || y < 0 || y >= height || !clip_span(x, length, width)) {
+        return false;
+    }
+    memcpy(row(y) + x * bytespp, pixels + (x - first) * bytespp, (unsigned long)length * bytespp);
+    return true;
+}
+
+int TGAImage::get_bytespp() const {
     return bytespp;
 }
 
-int TGAImage::get_width() {
+int TGAImage::get_width() const {
     return width;
 }
 
-int TGAImage::get_height() {
+int TGAImage::get_height() const {
     return height;
 }
 
+bool TGAImage::is_bottom_up() const {
+    return bottom_up_rows;
+}
+
+void TGAImage::set_bottom_up(bool bottom_up) {
+    bottom_up_rows = bottom_up;
+}
+
+namespace {
+    // pixels on a side of the tiles transposed at once, two tiles of rgba pixels take 8 KB
+    const int transpose_tile = 32;
+
+#if TR_SSE2
+    // SSE2 has no byte shuffle: the bytes of each word are swapped, then the words and the halves are reversed
+    __m128i reverse_pixels(__m128i v, int bytespp) {
+        if (TGAImage::RGBA == bytespp) return _mm_shuffle_epi32(v, 0x1b);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1b), 0x1b);
+        return _mm_shuffle_epi32(v, 0x4e);
+    }
+#endif
+
+    // swaps the pixels of a row end for end, a register from each end at a time, 3 byte pixels don't fit in one
+    template <typename Pixel>
+    void reverse_row(Pixel *row, int width) {
+        int left = 0;
+        int right = width; // [left, right) is still to reverse
+#if TR_SSE2
+        if (sizeof(Pixel) != 3) {
+            const int per_register = 16 / sizeof(Pixel);
+            for (; right - left >= 2 * per_register; left += per_register, right -= per_register) {
+                const __m128i a = _mm_loadu_si128((const __m128i *)(row + left));
+                const __m128i b = _mm_loadu_si128((const __m128i *)(row + right - per_register));
+                _mm_storeu_si128((__m128i *)(row + left), reverse_pixels(b, sizeof(Pixel)));
+                _mm_storeu_si128((__m128i *)(row + right - per_register), reverse_pixels(a, sizeof(Pixel)));
+            }
+        }
+#endif
+        for (; right - left >= 2; left++, right--) {
+            const Pixel p = row[left];
+            row[left] = row[right - 1];
+            row[right - 1] = p;
+        }
+    }
+
+    void swap_rows(unsigned char *a, unsigned char *b, unsigned long nbytes) {
+        unsigned long i = 0;
+#if TR_SSE2
+        for (; i + 16 <= nbytes; i += 16) {
+            const __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+            const __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+            _mm_storeu_si128((__m128i *)(a + i), y);
+            _mm_storeu_si128((__m128i *)(b + i), x);
+        }
+#endif
+        for (; i < nbytes; i++) {
+            const unsigned char t = a[i];
+            a[i] = b[i];
+            b[i] = t;
+        }
+    }
+
+    // dst(x, y) = src(y, x) for a block of rows x cols source pixels, strides in bytes.
+    // 4 x 4 blocks of rgba pixels are transposed in registers, the edges of the block a pixel at a time.
+    template <typename Pixel>
+    void transpose_block(const unsigned char *src, unsigned long src_stride, unsigned char *dst, unsigned long dst_stride, int rows, int cols) {
+        int rows4 = 0;
+        int cols4 = 0;
+#if TR_SSE2
+        if (sizeof(Pixel) == 4) {
+            rows4 = rows & ~3;
+            cols4 = cols & ~3;
+            for (int y = 0; y < rows4; y += 4) {
+                for (int x = 0; x < cols4; x += 4) {
+                    const unsigned char *s = src + y * src_stride + x * 4;
+                    const __m128i r0 = _mm_loadu_si128((const __m128i *)s);
+                    const __m128i r1 = _mm_loadu_si128((const __m128i *)(s + src_stride));
+                    const __m128i r2 = _mm_loadu_si128((const __m128i *)(s + 2 * src_stride));
+                    const __m128i r3 = _mm_loadu_si128((const __m128i *)(s + 3 * src_stride));
+                    const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+                    const __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+                    const __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+                    const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+                    unsigned char *d = dst + x * dst_stride + y * 4;
+                    _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi64(t0, t1));
+                    _mm_storeu_si128((__m128i *)(d + dst_stride), _mm_unpackhi_epi64(t0, t1));
+                    _mm_storeu_si128((__m128i *)(d + 2 * dst_stride), _mm_unpacklo_epi64(t2, t3));
+                    _mm_storeu_si128((__m128i *)(d + 3 * dst_stride), _mm_unpackhi_epi64(t2, t3));
+                }
+            }
+        }
+#endif
+        for (int y = 0; y < rows; y++) {
+            for (int x = y < rows4 ? cols4 : 0; x < cols; x++)
+                *(Pixel *)(dst + x * dst_stride + y * sizeof(Pixel)) = *(const Pixel *)(src + y * src_stride + x * sizeof(Pixel));
+        }
+    }
+
+    // tile pairs mirrored across the diagonal swap places through a tile sized buffer
+    template <typename Pixel>
+    void transpose_square(unsigned char *data, int n) {
+        const unsigned long stride = (unsigned long)n * sizeof(Pixel);
+        const unsigned long tile_stride = transpose_tile * sizeof(Pixel);
+        unsigned char tile[transpose_tile * transpose_tile * sizeof(Pixel)];
+        for (int ty = 0; ty < n; ty += transpose_tile) {
+            const int rows = n - ty < transpose_tile ? n - ty : transpose_tile;
+            for (int tx = ty; tx < n; tx += transpose_tile) {
+                const int cols = n - tx < transpose_tile ? n - tx : transpose_tile;
+                unsigned char *a = data + ty * stride + tx * sizeof(Pixel);
+                unsigned char *b = data + tx * stride + ty * sizeof(Pixel);
+                transpose_block<Pixel>(a, stride, tile, tile_stride, rows, cols);
+                if (a != b)
+                    transpose_block<Pixel>(b, stride, a, stride, cols, rows);
+                for (int y = 0; y < cols; y++)
+                    memcpy(b + y * stride, tile + y * tile_stride, rows * sizeof(Pixel));
+            }
+        }
+    }
+
+    template <typename Pixel>
+    void transpose_into(const unsigned char *src, int width, int height, unsigned char *dst) {
+        const unsigned long src_stride = (unsigned long)width * sizeof(Pixel);
+        const unsigned long dst_stride = (unsigned long)height * sizeof(Pixel);
+        for (int ty = 0; ty < height; ty += transpose_tile) {
+            const int rows = height - ty < transpose_tile ? height - ty : transpose_tile;
+            for (int tx = 0; tx < width; tx += transpose_tile) {
+                const int cols = width - tx < transpose_tile ? width - tx : transpose_tile;
+                transpose_block<Pixel>(src + ty * src_stride + tx * sizeof(Pixel), src_stride,
+                    dst + tx * dst_stride + ty * sizeof(Pixel), dst_stride, rows, cols);
+            }
+        }
+    }
+}
+
 bool TGAImage::flip_horizontally() {
     if (!data) return false;
-    int half = width >> 1;
-    for (int i = 0; i < half; i++) {
-        for (int j = 0; j < height; j++) {
-            TGAColor c1 = get(i, j);
-            TGAColor c2 = get(width - 1 - i, j);
-            set(i, j, c2);
-            set(width - 1 - i, j, c1);
+    detach();
+    for (int y = 0; y < height; y++) {
+        switch (bytespp) {
+        case GRAYSCALE: reverse_row(row_span<Gray8>(y).data, width); break;
+        case RGB: reverse_row(row_span<RGB8>(y).data, width); break;
+        case RGBA: reverse_row(row_span<RGBA8>(y).data, width); break;
+        default: return false;
         }
     }
     return true;
@@ -295,31 +917,64 @@ bool TGAImage::flip_horizontally() {
 
 bool TGAImage::flip_vertically() {
     if (!data) return false;
-    unsigned long bytes_per_line = width * bytespp;
-    unsigned char *line = new unsigned char[bytes_per_line];
-    int half = height >> 1;
-    for (int j = 0; j < half; j++) {
-        unsigned long l1 = j * bytes_per_line;
-        unsigned long l2 = (height - 1 - j)*bytes_per_line;
-        memmove((void *)line, (void *)(data + l1), bytes_per_line);
-        memmove((void *)(data + l1), (void *)(data + l2), bytes_per_line);
-        memmove((void *)(data + l2), (void *)line, bytes_per_line);
-    }
-    delete[] line;
+    detach();
+    const unsigned long bytes_per_line = (unsigned long)width * bytespp;
+    for (int y = 0; y < height / 2; y++)
+        swap_rows(row(y), row(height - 1 - y), bytes_per_line);
     return true;
 }
 
+bool TGAImage::transpose() {
+    TR_TRACE_SCOPE("TGAImage::transpose");
+    if (!data || (bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA)) return false;
+    if (width == height) {
+        detach();
+        switch (bytespp) {
+        case GRAYSCALE: transpose_square<Gray8>(data, width); break;
+        case RGB: transpose_square<RGB8>(data, width); break;
+        default: transpose_square<RGBA8>(data, width); break;
+        }
+        return true;
+    }
+    unsigned char *tdata = allocate((unsigned long)width * height * bytespp);
+    switch (bytespp) {
+    case GRAYSCALE: transpose_into<Gray8>(data, width, height, tdata); break;
+    case RGB: transpose_into<RGB8>(data, width, height, tdata); break;
+    default: transpose_into<RGBA8>(data, width, height, tdata); break;
+    }
+    release();
+    data = tdata;
+    const int w = width;
+    width = height;
+    height = w;
+    return true;
+}
+
+// Clockwise on a top-down image is the transpose flipped left to right, counterclockwise the transpose flipped
+// upside down. A bottom-up image is the picture upside down, so it turns the other way.
+bool TGAImage::rotate_90(bool clockwise) {
+    if (bottom_up_rows) clockwise = !clockwise;
+    if (!transpose()) return false;
+    return clockwise ? flip_horizontally() : flip_vertically();
+}
+
 unsigned char *TGAImage::buffer() {
+    detach();
+    return data;
+}
+
+const unsigned char *TGAImage::buffer() const {
     return data;
 }
 
 void TGAImage::clear() {
-    memset((void *)data, 0, width*height*bytespp);
+    detach();
+    memset((void *)data, 0, (unsigned long)width*height*bytespp);
 }
 
 bool TGAImage::scale(int w, int h) {
     if (w <= 0 || h <= 0 || !data) return false;
-    unsigned char *tdata = new unsigned char[w*h*bytespp];
+    unsigned char *tdata = allocate((unsigned long)w*h*bytespp);
     int nscanline = 0;
     int oscanline = 0;
     int erry = 0;
@@ -347,7 +1002,7 @@ bool TGAImage::scale(int w, int h) {
             nscanline += nlinebytes;
         }
     }
-    delete[] data;
+    release();
     data = tdata;
     width = w;
     height = h;
@@ -2,6 +2,9 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <mutex>
+#include <vector>
+#include <string.h>
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -13,8 +16,8 @@ struct TGA_Header {
     char colormapdepth;
     short x_origin;
     short y_origin;
-    short width;
-    short height;
+    unsigned short width;   // unsigned, up to 65535 pixels
+    unsigned short height;
     char  bitsperpixel;
     char  imagedescriptor;
 };
@@ -22,6 +25,9 @@ struct TGA_Header {
 
 
 
+// Four bytes, b g r a like the pixels of an rgba image: copied as one 32 bit word and packed four to an SSE register
+// (ColorOps.h). The color doesn't keep a bpp, the image knows its own: from a pixel only its bpp bytes are copied
+// and the others are zero, a packed value is taken whole and its bpp is ignored.
 struct TGAColor {
     union {
         struct {
@@ -30,67 +36,217 @@ struct TGAColor {
         unsigned char raw[4];
         unsigned int val;
     };
-    int bytespp;
 
-    TGAColor() : val(0), bytespp(1) {
+    TGAColor() : val(0) {
     }
 
-    TGAColor(unsigned char R, unsigned char G, unsigned char B, unsigned char A) : b(B), g(G), r(R), a(A), bytespp(4) {
+    TGAColor(unsigned char R, unsigned char G, unsigned char B, unsigned char A) : b(B), g(G), r(R), a(A) {
     }
 
-    TGAColor(int v, int bpp) : val(v), bytespp(bpp) {
+    TGAColor(int v, int /*bpp*/) : val(v) {
     }
 
-    TGAColor(const TGAColor &c) : val(c.val), bytespp(c.bytespp) {
+    TGAColor(const unsigned char *p, int bpp) : val(0) {
+        memcpy(raw, p, bpp);
     }
+};
 
-    TGAColor(const unsigned char *p, int bpp) : val(0), bytespp(bpp) {
-        for (int i = 0; i < bpp; i++) {
-            raw[i] = p[i];
-        }
-    }
 
-    TGAColor & operator =(const TGAColor &c) {
-        if (this != &c) {
-            bytespp = c.bytespp;
-            val = c.val;
-        }
-        return *this;
+// The pixels as they are stored in a TGAImage buffer, for the typed row access below.
+struct Gray8 {
+    unsigned char v;
+};
+
+struct RGB8 {
+    unsigned char b, g, r;
+};
+
+struct RGBA8 {
+    unsigned char b, g, r, a;
+};
+
+// A run of pixels in a buffer it doesn't own, no bounds checks.
+template <typename Pixel>
+struct Span {
+    Pixel *data;
+    int size;
+
+    Pixel &operator[](int i) const {
+        return data[i];
+    }
+    Pixel *begin() const {
+        return data;
+    }
+    Pixel *end() const {
+        return data + size;
     }
 };
 
 
+class MappedFile;
+
+// Pixel buffers given back by the images, kept by size for the next image of the same size instead of going back
+// to the heap: images made frame after frame or job after job stop allocating once the first ones are freed.
+// Optional, TGAImage::set_buffer_pool puts one in use for every image. Thread safe.
+class TGABufferPool {
+public:
+    explicit TGABufferPool(unsigned long max_bytes = 512ul << 20);
+    ~TGABufferPool(); // frees the buffers it holds, stop using the pool first
+    unsigned char *acquire(unsigned long nbytes); // a held buffer of exactly nbytes, NULL when there is none
+    bool give_back(unsigned char *buffer, unsigned long nbytes); // false when it would hold more than max_bytes
+    unsigned long held_bytes() const;
+private:
+    struct Buffer {
+        unsigned char *data;
+        unsigned long nbytes;
+    };
+    TGABufferPool(const TGABufferPool &);
+    TGABufferPool &operator =(const TGABufferPool &);
+
+    mutable std::mutex mutex;
+    std::vector<Buffer> buffers; // reserved up front, giving a buffer back doesn't allocate either
+    unsigned long max_bytes;
+    unsigned long held;
+};
+
 class TGAImage {
 protected:
     unsigned char* data;
     int width;
     int height;
     int bytespp;
+    MappedFile* mapping; // set while data points into a mapped file instead of an own buffer
+    bool bottom_up_rows; // the first row is the bottom of the picture
 
     bool   load_rle_data(std::ifstream &in);
-    bool unload_rle_data(std::ofstream &out);
+    bool   load_rle_data(const unsigned char *in, const unsigned char *end, bool bottom_up);
+    bool unload_rle_data(std::ofstream &out, int nthreads);
+    void release();
+    void detach();
+    // width * height * bytespp bytes aligned on 64 for SIMD, from the pool in use when it has a buffer that size.
+    // The size given back must be the one allocated, release computes it from the current dimensions.
+    static unsigned char *allocate(unsigned long nbytes);
+    static void deallocate(unsigned char *buffer, unsigned long nbytes);
 public:
     enum Format {
         GRAYSCALE = 1, RGB = 3, RGBA = 4
     };
+    enum {
+        max_dimension = 65535 // the header stores the width and height on 16 bits
+    };
 
     TGAImage();
     TGAImage(int w, int h, int bpp);
     TGAImage(const TGAImage &img);
+    TGAImage(TGAImage &&img) noexcept; // takes the pixels (or the mapping), img is left empty
     bool read_tga_file(const char *filename);
-    bool write_tga_file(const char *filename, bool rle = true);
+    // Maps the file instead of streaming it in: an uncompressed image stored top-down stays a read-only view
+    // of the mapping, with no copy at all, anything else is decoded straight from the mapped bytes.
+    // A view gets its own copy of the pixels the first time it is modified.
+    bool map_tga_file(const char *filename);
+    bool is_view() const;
+    // Images over a million pixels are RLE encoded in row bands over nthreads threads (0 is one per core), pass 1
+    // when the caller already keeps the cores busy. Smaller ones are a single band, encoded on the calling thread.
+    bool write_tga_file(const char *filename, bool rle = true, int nthreads = 0);
+    // QOI (qoi.cpp) next to tga: runs, an index of recently seen pixels and small differences, encoded and decoded
+    // in one pass. Files and buffers are standard QOI, rgb or rgba, a grayscale image is written as rgb.
+    bool read_qoi_file(const char *filename);
+    bool write_qoi_file(const char *filename) const;
+    bool encode_qoi(std::vector<unsigned char> &out) const;
+    bool decode_qoi(const unsigned char *in, unsigned long size);
+    // Orientation is metadata: a bottom-up image keeps its rows as they are and is written with a bottom-left
+    // origin instead of being flipped (qoi has no origin, its rows are encoded in reverse). Reading a file always
+    // gives a top-down image, the images built by the renderers are bottom-up, y going up.
+    bool is_bottom_up() const;
+    void set_bottom_up(bool bottom_up);
+    // In place, on SSE2 registers where the pixel size allows it. transpose swaps x and y of the stored pixels,
+    // in 32 x 32 tiles so both the rows read and the rows written stay in cache; an image that isn't square gets
+    // a new buffer. rotate_90 turns the picture as it is displayed, orientation included.
     bool flip_horizontally();
     bool flip_vertically();
+    bool transpose();
+    bool rotate_90(bool clockwise = true);
     bool scale(int w, int h);
+    // Filtered scaling (resample.cpp) for thumbnails and mip levels, where scale only picks the nearest pixels.
+    // Separable horizontal then vertical passes on SSE2 floats, each split in row bands over nthreads threads
+    // (0 is one per core). Minifying widens the filter so every source pixel is weighted in.
+    enum Filter {
+        BOX, BILINEAR, LANCZOS3
+    };
+    bool resample(int w, int h, Filter filter = LANCZOS3, int nthreads = 0);
     TGAColor get(int x, int y);
-    bool set(int x, int y, TGAColor c);
+    bool set(int x, int y, const TGAColor &c);
+    // Bulk access without the per pixel checks of get and set: a row is width pixels of bytespp bytes, y must be
+    // in [0, height) and Pixel must have bytespp bytes. Writing through a row of a view copies the view first.
+    unsigned char *row(int y);
+    const unsigned char *row(int y) const;
+    template <typename Pixel> Span<Pixel> row_span(int y) {
+        return Span<Pixel>{ reinterpret_cast<Pixel *>(row(y)), width };
+    }
+    template <typename Pixel> Span<const Pixel> row_span(int y) const {
+        return Span<const Pixel>{ reinterpret_cast<const Pixel *>(row(y)), width };
+    }
+    // length pixels from (x, y) on, clipped to the row once instead of checked per pixel
+    bool fill_span(int x, int y, int length, const TGAColor &c);
+    bool copy_span(int x, int y, int length, const unsigned char *pixels);
     ~TGAImage();
-    TGAImage & operator =(const TGAImage &img);
-    int get_width();
-    int get_height();
-    int get_bytespp();
-    unsigned char *buffer();
+    TGAImage & operator =(const TGAImage &img); // reuses the buffer when the sizes match
+    TGAImage & operator =(TGAImage &&img) noexcept;
+    static void set_buffer_pool(TGABufferPool *pool); // NULL goes back to the heap
+    static unsigned long buffer_allocations(); // pixel buffers taken from the heap so far, not from a pool
+    int get_width() const;
+    int get_height() const;
+    int get_bytespp() const;
+    unsigned char *buffer(); // the caller can write through it, a view is copied first
+    const unsigned char *buffer() const;
     void clear();
 };
 
+// Writes a tga file band by band for images that don't fit in memory: the rows are pushed in order, every band
+// is encoded and written right away, so only the band being pushed has to be held.
+// With bottom_up the rows are pushed from the bottom of the image up, like the renderers' images are stored,
+// and the file gets a bottom-left origin instead of being flipped.
+class TGAWriter {
+protected:
+    std::ofstream out;
+    int width;
+    int height;
+    int bytespp;
+    bool rle;
+    int rows;
+    int nthreads;
+public:
+    TGAWriter();
+    ~TGAWriter();
+    // nthreads is for the RLE encoding of the bands, like write_tga_file
+    bool open(const char *filename, int w, int h, int bpp, bool rle = true, bool bottom_up = false, int nthreads = 0);
+    bool write_rows(const unsigned char *pixels, int nrows);
+    bool write_band(const TGAImage &band); // all the rows of an image as wide as the file
+    bool close(); // fails when some rows are missing
+    int rows_written() const;
+};
+
+// The same for qoi files, the rows are always pushed top to bottom and the encoder carries on from band to band,
+// each band is written as soon as it is encoded.
+class QOIWriter {
+protected:
+    std::ofstream out;
+    int width;
+    int height;
+    int bytespp;
+    int rows;
+    unsigned int index[64]; // the encoder's state between two bands
+    unsigned int previous;
+    int run;
+    std::vector<unsigned char> encoded;
+public:
+    QOIWriter();
+    ~QOIWriter();
+    bool open(const char *filename, int w, int h, int bpp);
+    bool write_rows(const unsigned char *pixels, int nrows);
+    bool write_band(const TGAImage &band);
+    bool close(); // fails when some rows are missing
+    int rows_written() const;
+};
+
 #endif //__IMAGE_H__